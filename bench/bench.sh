@@ -0,0 +1,76 @@
+#!/bin/sh
+# Benchmark the ls versions, and the current ls, on synthetic trees.
+#
+# Usage: bench/bench.sh [BIN_DIR]
+#
+#   BENCH_DIR    where the trees are generated (default /tmp/ls-bench)
+#   BENCH_SIZES  flat directory sizes (default "10000 100000 1000000")
+#   BENCH_RUNS   runs per case, the fastest is reported (default 3)
+#
+# Every case reports wall time and peak RSS (best of BENCH_RUNS), the total
+# syscall count (runstat -c, via ptrace), and the stat calls and
+# allocations seen by the countwrap LD_PRELOAD shim.
+
+set -e
+
+BIN=${1:-bench/bin}
+BENCH_DIR=${BENCH_DIR:-/tmp/ls-bench}
+BENCH_SIZES=${BENCH_SIZES:-"10000 100000 1000000"}
+BENCH_RUNS=${BENCH_RUNS:-3}
+SHIM=$(cd "$BIN" && pwd)/countwrap.so
+COUNTS=$(mktemp)
+trap 'rm -f "$COUNTS"' EXIT
+
+echo "Generating trees in $BENCH_DIR"
+mkdir -p "$BENCH_DIR"
+for n in $BENCH_SIZES; do
+    "$BIN/gentree" flat "$BENCH_DIR/flat-$n" "$n"
+done
+"$BIN/gentree" deep  "$BENCH_DIR/deep"  300
+"$BIN/gentree" wide  "$BENCH_DIR/wide"  1000
+"$BIN/gentree" mixed "$BENCH_DIR/mixed" 20000
+
+# run VERSION MODE TREE CMD...
+run() {
+    version=$1 mode=$2 tree=$3
+    shift 3
+    best_ms= best_rss=
+    i=0
+    while [ "$i" -lt "$BENCH_RUNS" ]; do
+        # Only the measured command gets the shim, not runstat itself
+        out=$("$BIN/runstat" env LD_PRELOAD="$SHIM" COUNTWRAP_OUT="$COUNTS" "$@" 2>/dev/null) || true
+        ms=${out% *} rss=${out#* }
+        if [ -z "$best_ms" ] || awk -v a="$ms" -v b="$best_ms" 'BEGIN { exit !(a < b) }'; then
+            best_ms=$ms best_rss=$rss
+        fi
+        i=$((i + 1))
+    done
+    syscalls=$("$BIN/runstat" -c "$@" 2>/dev/null) || true
+    stats=$(awk '$1 == "stat" || $1 == "statx" { n += $2 } END { print n }' "$COUNTS")
+    allocs=$(awk '$1 == "allocs" { print $2 }' "$COUNTS")
+    printf '%-8s %-6s %-14s %10s %10s %10s %10s %10s\n' \
+        "$version" "$mode" "$tree" "$best_ms" "$best_rss" "$syscalls" "$stats" "$allocs"
+}
+
+printf '%-8s %-6s %-14s %10s %10s %10s %10s %10s\n' \
+    version mode tree wall_ms rss_kb syscalls stats allocs
+
+for tree in $(cd "$BENCH_DIR" && ls -d flat-* mixed); do
+    dir=$BENCH_DIR/$tree
+    run v1.4.0 -l "$tree" "$BIN/ls-v1.4.0" -l "$dir"
+    run current -l "$tree" "$BIN/ls" -l "$dir"
+    run v1.4.0 -x "$tree" "$BIN/ls-v1.4.0" -x "$dir"
+    run current -x "$tree" "$BIN/ls" -x "$dir"
+    # v1.5.0 always colors; the current ls only on a terminal, so it is
+    # told to
+    run v1.5.0 color "$tree" "$BIN/ls-v1.5.0" "$dir"
+    run current color "$tree" "$BIN/ls" --color=always "$dir"
+done
+
+for tree in deep wide mixed; do
+    dir=$BENCH_DIR/$tree
+    run v1.6.0 -R "$tree" "$BIN/ls-v1.6.0" -R "$dir"
+    run current -R "$tree" "$BIN/ls" -R "$dir"
+    run current -lR "$tree" "$BIN/ls" -l -R "$dir"
+    run current -UR "$tree" "$BIN/ls" -U -R "$dir"
+done
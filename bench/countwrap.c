@@ -0,0 +1,122 @@
+/*
+ * countwrap - LD_PRELOAD shim that counts syscalls and allocations
+ *
+ * Interposes the libc entry points an ls implementation uses to reach the
+ * kernel (open/opendir, getdents64 through syscall(), the stat family,
+ * write/writev, close) plus malloc/calloc/realloc/free. Counts are written
+ * as "name count" lines to $COUNTWRAP_OUT (or stderr) when the process
+ * exits. Calls libc makes internally (e.g. the getdents64 behind readdir)
+ * are not visible here; opendir and readdir are counted instead.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+enum {
+    C_OPEN, C_OPENDIR, C_READDIR, C_GETDENTS, C_STAT, C_STATX, C_WRITE, C_CLOSE,
+    C_OTHER_SYSCALL, C_MALLOC, C_CALLOC, C_REALLOC, C_FREE, C_COUNT
+};
+
+static const char *counter_names[C_COUNT] = {
+    "open", "opendir", "readdir", "getdents64", "stat", "statx", "write", "close",
+    "other_syscall", "malloc", "calloc", "realloc", "free"
+};
+
+static unsigned long counters[C_COUNT];
+
+#define COUNT(c) __atomic_fetch_add(&counters[c], 1, __ATOMIC_RELAXED)
+#define REAL(name) static __typeof__(name) *real_##name; \
+    if (!real_##name) real_##name = (__typeof__(name) *)dlsym(RTLD_NEXT, #name)
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+void *malloc(size_t size) { COUNT(C_MALLOC); return __libc_malloc(size); }
+void *calloc(size_t n, size_t size) { COUNT(C_CALLOC); return __libc_calloc(n, size); }
+void *realloc(void *p, size_t size) { COUNT(C_REALLOC); return __libc_realloc(p, size); }
+void free(void *p) { if (p) COUNT(C_FREE); __libc_free(p); }
+
+int open(const char *path, int flags, ...) {
+    REAL(open);
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = (flags & (O_CREAT | O_TMPFILE)) ? va_arg(ap, mode_t) : 0;
+    va_end(ap);
+    COUNT(C_OPEN);
+    return real_open(path, flags, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...) {
+    REAL(openat);
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = (flags & (O_CREAT | O_TMPFILE)) ? va_arg(ap, mode_t) : 0;
+    va_end(ap);
+    COUNT(C_OPEN);
+    return real_openat(dirfd, path, flags, mode);
+}
+
+DIR *opendir(const char *path) { REAL(opendir); COUNT(C_OPENDIR); return real_opendir(path); }
+DIR *fdopendir(int fd) { REAL(fdopendir); COUNT(C_OPENDIR); return real_fdopendir(fd); }
+struct dirent *readdir(DIR *d) { REAL(readdir); COUNT(C_READDIR); return real_readdir(d); }
+
+int stat(const char *path, struct stat *st) { REAL(stat); COUNT(C_STAT); return real_stat(path, st); }
+int lstat(const char *path, struct stat *st) { REAL(lstat); COUNT(C_STAT); return real_lstat(path, st); }
+int fstat(int fd, struct stat *st) { REAL(fstat); COUNT(C_STAT); return real_fstat(fd, st); }
+int fstatat(int dirfd, const char *path, struct stat *st, int flags) {
+    REAL(fstatat);
+    COUNT(C_STAT);
+    return real_fstatat(dirfd, path, st, flags);
+}
+int statx(int dirfd, const char *path, int flags, unsigned int mask, struct statx *stx) {
+    REAL(statx);
+    COUNT(C_STATX);
+    return real_statx(dirfd, path, flags, mask, stx);
+}
+
+ssize_t write(int fd, const void *buf, size_t n) { REAL(write); COUNT(C_WRITE); return real_write(fd, buf, n); }
+ssize_t writev(int fd, const struct iovec *iov, int cnt) { REAL(writev); COUNT(C_WRITE); return real_writev(fd, iov, cnt); }
+int close(int fd) { REAL(close); COUNT(C_CLOSE); return real_close(fd); }
+
+long syscall(long number, ...) {
+    REAL(syscall);
+    va_list ap;
+    va_start(ap, number);
+    long a1 = va_arg(ap, long), a2 = va_arg(ap, long), a3 = va_arg(ap, long);
+    long a4 = va_arg(ap, long), a5 = va_arg(ap, long), a6 = va_arg(ap, long);
+    va_end(ap);
+    COUNT(number == SYS_getdents64 ? C_GETDENTS : C_OTHER_SYSCALL);
+    return real_syscall(number, a1, a2, a3, a4, a5, a6);
+}
+
+__attribute__((destructor))
+static void report(void) {
+    const char *out = getenv("COUNTWRAP_OUT");
+    FILE *f = out ? fopen(out, "w") : stderr;
+    if (!f)
+        return;
+
+    unsigned long syscalls = 0;
+    for (int i = C_OPEN; i <= C_OTHER_SYSCALL; i++) {
+        if (i != C_READDIR)
+            syscalls += counters[i];
+    }
+    unsigned long allocs = counters[C_MALLOC] + counters[C_CALLOC] + counters[C_REALLOC];
+
+    for (int i = 0; i < C_COUNT; i++)
+        fprintf(f, "%s %lu\n", counter_names[i], counters[i]);
+    fprintf(f, "syscalls %lu\nallocs %lu\n", syscalls, allocs);
+    if (f != stderr)
+        fclose(f);
+}
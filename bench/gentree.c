@@ -0,0 +1,137 @@
+/*
+ * gentree - build synthetic directory trees for `make bench`
+ *
+ *   gentree flat  DIR N      N empty files in one directory
+ *   gentree deep  DIR DEPTH  a chain of DEPTH nested directories, 8 files each
+ *   gentree wide  DIR N      N subdirectories with 100 files each
+ *   gentree mixed DIR N      N entries of mixed types: regular, executable,
+ *                            archives, directories, symlinks and fifos
+ *
+ * A finished tree is marked with DIR/.complete so it is not rebuilt.
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+int make_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+int make_file(const char *path, mode_t mode) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+// Names of varying length so the layout and sort see realistic input
+void entry_name(char *buf, size_t size, const char *prefix, long i) {
+    static const char *tails[] = { "", "_a", "_data", "_backup_copy", "_2025-10-06_final" };
+    snprintf(buf, size, "%s%07ld%s", prefix, (i * 7919) % 10000000, tails[i % 5]);
+}
+
+int gen_flat(const char *dir, long n) {
+    char path[4096], name[256];
+    for (long i = 0; i < n; i++) {
+        entry_name(name, sizeof(name), "file_", i);
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (make_file(path, 0644) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+int gen_deep(const char *dir, long depth) {
+    char path[8192];
+    snprintf(path, sizeof(path), "%s", dir);
+    for (long d = 0; d < depth; d++) {
+        size_t len = strlen(path);
+        for (int i = 0; i < 8; i++) {
+            snprintf(path + len, sizeof(path) - len, "/f%d", i);
+            if (make_file(path, 0644) == -1)
+                return -1;
+        }
+        snprintf(path + len, sizeof(path) - len, "/d");
+        if (len + 3 >= sizeof(path) || make_dir(path) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+int gen_wide(const char *dir, long n) {
+    char path[4096];
+    for (long i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/dir_%06ld", dir, i);
+        if (make_dir(path) == -1 || gen_flat(path, 100) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+int gen_mixed(const char *dir, long n) {
+    char path[4096], name[256];
+    for (long i = 0; i < n; i++) {
+        int kind = i % 10;
+        entry_name(name, sizeof(name), "entry_", i);
+        snprintf(path, sizeof(path), "%s/%s%s", dir, name,
+                 kind == 2 ? ".tar.gz" : kind == 3 ? ".zip" : "");
+
+        int rc;
+        switch (kind) {
+            case 1:  rc = make_file(path, 0755); break;
+            case 4:  rc = make_dir(path); break;
+            case 5:  rc = symlink(".", path); break;
+            case 6:  rc = symlink("missing-target", path); break;
+            case 7:  rc = mkfifo(path, 0644); break;
+            default: rc = make_file(path, 0644); break;
+        }
+        if (rc == -1 && errno != EEXIST) {
+            perror(path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s flat|deep|wide|mixed DIR N\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *kind = argv[1], *dir = argv[2];
+    long n = atol(argv[3]);
+    char marker[4096];
+    snprintf(marker, sizeof(marker), "%s/.complete", dir);
+
+    if (access(marker, F_OK) == 0)
+        return 0;
+    if (make_dir(dir) == -1)
+        return EXIT_FAILURE;
+
+    int rc;
+    if (strcmp(kind, "flat") == 0) rc = gen_flat(dir, n);
+    else if (strcmp(kind, "deep") == 0) rc = gen_deep(dir, n);
+    else if (strcmp(kind, "wide") == 0) rc = gen_wide(dir, n);
+    else if (strcmp(kind, "mixed") == 0) rc = gen_mixed(dir, n);
+    else {
+        fprintf(stderr, "%s: unknown tree kind '%s'\n", argv[0], kind);
+        return EXIT_FAILURE;
+    }
+
+    if (rc == -1 || make_file(marker, 0644) == -1)
+        return EXIT_FAILURE;
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * runstat - run a command and report its wall time and peak RSS
+ *
+ *   runstat CMD [ARGS...]      prints "WALL_MS MAXRSS_KB"
+ *   runstat -c CMD [ARGS...]   prints the number of syscalls made
+ *
+ * The command's stdout goes to /dev/null and runstat exits with the
+ * command's status. -c traces every thread of the command with ptrace, so
+ * it also sees the syscalls libc makes internally (stdio writes, the
+ * getdents64 behind readdir); its timing is meaningless, so it is kept
+ * separate from the timed run.
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+pid_t spawn(char *argv[], int traced) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd != -1)
+            dup2(fd, STDOUT_FILENO);
+        if (traced) {
+            ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+            raise(SIGSTOP);
+        }
+        execvp(argv[0], argv);
+        perror("exec failed");
+        _exit(127);
+    }
+    return pid;
+}
+
+// Count syscall entries of pid and every thread it creates.
+int count_syscalls(char *argv[]) {
+    pid_t pid = spawn(argv, 1);
+    int status;
+    unsigned long syscalls = 0;
+    int exit_status = EXIT_FAILURE;
+
+    if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) {
+        perror("trace failed");
+        return EXIT_FAILURE;
+    }
+    ptrace(PTRACE_SETOPTIONS, pid, NULL,
+           PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+    // Every syscall produces an entry and an exit stop; count half of them
+    unsigned long stops = 0;
+    for (;;) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid == -1)
+            break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == pid)
+                exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+            continue;
+        }
+
+        int sig = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+            stops++;
+        else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP)
+            sig = WSTOPSIG(status);
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void *)(long)sig);
+    }
+
+    syscalls = (stops + 1) / 2;
+    printf("%lu\n", syscalls);
+    return exit_status;
+}
+
+int main(int argc, char *argv[]) {
+    int count = argc > 1 && strcmp(argv[1], "-c") == 0;
+    if (argc < 2 + count) {
+        fprintf(stderr, "Usage: %s [-c] CMD [ARGS...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (count)
+        return count_syscalls(argv + 2);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = spawn(argv + 1, 0);
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) == -1) {
+        perror("wait4 failed");
+        return EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf("%.1f %ld\n", ms, ru.ru_maxrss);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
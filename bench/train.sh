@@ -0,0 +1,62 @@
+#!/bin/sh
+# Training run for `make pgo`: exercise an instrumented ls on the benchmark
+# trees so its profile covers every stage the benchmarks measure.
+#
+# Usage: bench/train.sh LS [BIN_DIR]
+#
+#   BENCH_DIR    where the trees are generated (default /tmp/ls-bench)
+#   TRAIN_SIZES  flat directory sizes (default "10000 100000")
+#
+# The trees are the ones bench.sh uses and are shared with it; the 1M-entry
+# directory is left out by default, as it adds time but no new code paths.
+
+set -e
+
+LS=$1
+BIN=${2:-bench/bin}
+BENCH_DIR=${BENCH_DIR:-/tmp/ls-bench}
+TRAIN_SIZES=${TRAIN_SIZES:-"10000 100000"}
+
+if [ -z "$LS" ]; then
+    echo "Usage: $0 LS [BIN_DIR]" >&2
+    exit 1
+fi
+
+echo "Generating trees in $BENCH_DIR"
+mkdir -p "$BENCH_DIR"
+for n in $TRAIN_SIZES; do
+    "$BIN/gentree" flat "$BENCH_DIR/flat-$n" "$n"
+done
+"$BIN/gentree" deep  "$BENCH_DIR/deep"  300
+"$BIN/gentree" wide  "$BENCH_DIR/wide"  1000
+"$BIN/gentree" mixed "$BENCH_DIR/mixed" 20000
+
+# train ARGS... (the output is not needed, only the profile)
+train() {
+    echo "training: ls $*"
+    "$LS" "$@" >/dev/null
+}
+
+for n in $TRAIN_SIZES; do
+    dir=$BENCH_DIR/flat-$n
+    train "$dir"
+    train -x "$dir"
+    train -l "$dir"
+    train -t --top=50 "$dir"
+done
+
+dir=$BENCH_DIR/mixed
+train "$dir"
+train -l "$dir"
+train --color=always "$dir"
+train --color=always -l "$dir"
+train --format=ndjson "$dir"
+
+for tree in deep wide mixed; do
+    dir=$BENCH_DIR/$tree
+    train -R "$dir"
+    train -l -R "$dir"
+    train -U -R "$dir"
+    train --threads=4 -R "$dir"
+    train -s "$dir"
+done
@@ -0,0 +1,103 @@
+#include "ls.h"
+
+// Everything the serial walk and the printer allocate per directory
+struct arena arena;
+
+static struct arena_chunk *arena_new_chunk(struct arena *a, size_t need) {
+    struct arena_chunk **pp = &a->free_list;
+    while (*pp) {
+        if ((*pp)->size >= need) {
+            struct arena_chunk *c = *pp;
+            *pp = c->prev;
+            c->used = 0;
+            c->prev = a->head;
+            a->head = c;
+            return c;
+        }
+        pp = &(*pp)->prev;
+    }
+
+    size_t size = ARENA_CHUNK_SIZE;
+    while (size < need)
+        size *= 2;
+
+    struct arena_chunk *c = malloc(sizeof(struct arena_chunk) + size);
+    if (!c)
+        return NULL;
+    c->size = size;
+    c->used = 0;
+    c->prev = a->head;
+    a->head = c;
+    a->reserved += size;
+    a->chunk_mallocs++;
+    return c;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    struct arena_chunk *c = a->head;
+    if (!c || c->size - c->used < size) {
+        c = arena_new_chunk(a, size);
+        if (!c)
+            return NULL;
+    }
+
+    void *p = c->data + c->used;
+    c->used += size;
+    a->in_use += size;
+    if (a->in_use > a->peak)
+        a->peak = a->in_use;
+    return p;
+}
+
+// Make room for need more bytes after an open block of len bytes at the top
+// of the arena. The block may move to a new chunk; its (possibly new) start
+// is returned. Pass block == NULL to open a new block.
+char *arena_extend(struct arena *a, char *block, size_t len, size_t need) {
+    struct arena_chunk *c = a->head;
+    if (c && c->size - c->used >= len + need)
+        return block ? block : c->data + c->used;
+
+    struct arena_chunk *old = c;
+    c = arena_new_chunk(a, block ? 2 * (len + need) : need);
+    if (!c)
+        return NULL;
+    if (block) {
+        memcpy(c->data, block, len);
+        // The abandoned copy stays allocated until the directory is released
+        a->in_use += old->size - old->used;
+        old->used = old->size;
+    }
+    return c->data;
+}
+
+// Room left after an open block of len bytes.
+size_t arena_block_room(struct arena *a, size_t len) {
+    return a->head->size - a->head->used - len;
+}
+
+// Commit an open block started with arena_extend().
+void arena_close_block(struct arena *a, size_t len) {
+    len = (len + 7) & ~(size_t)7;
+    a->head->used += len;
+    a->in_use += len;
+    if (a->in_use > a->peak)
+        a->peak = a->in_use;
+}
+
+struct arena_mark arena_get_mark(struct arena *a) {
+    struct arena_mark m = { a->head, a->head ? a->head->used : 0, a->in_use };
+    return m;
+}
+
+void arena_release(struct arena *a, struct arena_mark m) {
+    while (a->head != m.chunk) {
+        struct arena_chunk *c = a->head;
+        a->head = c->prev;
+        c->prev = a->free_list;
+        a->free_list = c;
+    }
+    if (a->head)
+        a->head->used = m.used;
+    a->in_use = m.in_use;
+}
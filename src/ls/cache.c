@@ -0,0 +1,392 @@
+#include "ls.h"
+
+/*
+ * Directory snapshot cache (--cache[=FILE])
+ *
+ * A sorted listing (entries, packed names and, for -l, the stat slots) is
+ * saved per directory, keyed by its (dev, ino) and valid as long as the
+ * directory's mtime and ctime are unchanged. A hit is served straight out
+ * of the mapped file: no getdents64, no stat, no sort. The mapping is
+ * private, so entries can still be updated in place while printing.
+ *
+ * Adding, removing or renaming an entry changes the directory's times, but
+ * writing to a file does not, so cached sizes and times, and an order by
+ * them (-t, -S), go stale until something in the directory changes; the
+ * cache is for trees that are mostly static. A directory changed within
+ * the last second is not saved, as a second change in the same clock tick
+ * would not be seen.
+ *
+ * Each context (locale, sort options, record layout) has a file of its
+ * own, FILE.<context hash>, so switching between, say, ls and ls -t keeps
+ * both sets of records. A file is a header, the records and an
+ * open-addressing index of record offsets, probed at most index_cap
+ * times. New records are kept in memory and, only when there are any,
+ * written out at exit with the records still valid into a new file that
+ * replaces the old one.
+ */
+#define SNAP_MAGIC "lssnap01"
+
+struct snap_header {
+    char magic[8];
+    uint64_t context;       // locale and record layout the file was made with
+    uint64_t records_end;   // the index follows the records
+    uint64_t index_cap;     // power of two
+};
+
+// Followed by the slots (if mask is not 0), the entries and the names
+struct snap_record {
+    uint64_t dev, ino;
+    int64_t mtime_sec, ctime_sec;
+    uint32_t mtime_nsec, ctime_nsec;
+    uint32_t count;
+    uint32_t mask;          // statx fields in the slots, 0 without slots
+    uint32_t names_len;
+    uint32_t max_width;
+    uint64_t size;          // of the whole record, padded to 8 bytes
+};
+
+static struct {
+    const char *path;       // NULL when the cache is off
+    uint64_t context;
+    char *map;              // the file as loaded, NULL if there was none
+    size_t map_size;
+    const struct snap_header *hdr;
+    pthread_mutex_t lock;   // workers store records concurrently
+    char *fresh;            // records built this run, from offset 8
+    size_t fresh_len, fresh_cap, fresh_count;
+    time_t started;
+    size_t hits, misses;
+} snap = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t snap_hash(uint64_t dev, uint64_t ino) {
+    uint64_t h = (ino ^ (dev << 32 | dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+static uint64_t snap_record_size(uint32_t count, uint32_t mask, uint32_t names_len) {
+    uint64_t size = sizeof(struct snap_record) + (uint64_t)count * sizeof(struct file_entry) +
+                    names_len;
+    if (mask)
+        size += (uint64_t)count * sizeof(struct stat_slot);
+    return (size + 7) & ~(uint64_t)7;
+}
+
+// The record at off in the loaded file, or NULL if it is out of bounds
+static struct snap_record *snap_record_at(uint64_t off) {
+    if (off < sizeof(struct snap_header) || off % 8 ||
+        off + sizeof(struct snap_record) > snap.hdr->records_end)
+        return NULL;
+    struct snap_record *rec = (struct snap_record *)(snap.map + off);
+    if (rec->size > snap.hdr->records_end - off ||
+        rec->size < snap_record_size(rec->count, rec->mask, rec->names_len))
+        return NULL;
+    return rec;
+}
+
+int snap_enabled(void) {
+    return snap.path != NULL;
+}
+
+// $XDG_CACHE_HOME/ls-snapshots, or ~/.cache/ls-snapshots. The directory
+// is created if needed. Returns NULL if there is no home directory.
+char *snap_default_path(void) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    const char *sub = "";
+    if (!base || base[0] != '/') {
+        if (!home || !home[0])
+            return NULL;
+        base = home;
+        sub = "/.cache";
+    }
+
+    size_t len = strlen(base) + strlen(sub) + sizeof("/ls-snapshots");
+    char *path = malloc(len);
+    stats_count(STATS_MALLOCS);
+    if (!path)
+        return NULL;
+    snprintf(path, len, "%s%s", base, sub);
+    mkdir(path, 0700);
+    strcat(path, "/ls-snapshots");
+    return path;
+}
+
+// Open (and map) the cache file for context, which identifies everything a
+// record depends on besides the directory itself
+void snap_open(const char *path, uint64_t context) {
+    size_t len = strlen(path) + sizeof(".0123456789abcdef");
+    char *ctx_path = malloc(len);
+    stats_count(STATS_MALLOCS);
+    if (!ctx_path) {
+        perror("malloc failed");
+        return;
+    }
+    snprintf(ctx_path, len, "%s.%016llx", path, (unsigned long long)context);
+    snap.path = ctx_path;
+    snap.context = context;
+    snap.started = time(NULL);
+
+    int fd = open(ctx_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct snap_header)) {
+        char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        const struct snap_header *hdr = (const struct snap_header *)map;
+        if (map == MAP_FAILED) {
+            perror("cache mmap failed");
+        } else if (memcmp(hdr->magic, SNAP_MAGIC, 8) != 0 || hdr->context != context ||
+                   hdr->records_end < sizeof(struct snap_header) || hdr->records_end % 8 ||
+                   hdr->records_end > (uint64_t)st.st_size || hdr->index_cap == 0 ||
+                   hdr->index_cap & (hdr->index_cap - 1) ||
+                   hdr->index_cap > ((uint64_t)st.st_size - hdr->records_end) / 8) {
+            // Another format, a hash collision or a damaged file: start over
+            munmap(map, st.st_size);
+        } else {
+            snap.map = map;
+            snap.map_size = st.st_size;
+            snap.hdr = hdr;
+        }
+    }
+    close(fd);
+}
+
+// Serve the directory dir from the cache if it is unchanged and its record
+// has at least the stat fields in mask. Returns 0 and fills l on a hit.
+int snap_lookup(const struct stat *dir, unsigned int mask, struct entry_list *l) {
+    const uint64_t *index = snap.hdr ? (const uint64_t *)(snap.map + snap.hdr->records_end) : NULL;
+    struct snap_record *rec = NULL;
+    if (index) {
+        size_t cap_mask = snap.hdr->index_cap - 1;
+        size_t i = snap_hash(dir->st_dev, dir->st_ino) & cap_mask;
+        for (size_t n = 0; n <= cap_mask && index[i]; n++, i = (i + 1) & cap_mask) {
+            struct snap_record *r = snap_record_at(index[i]);
+            if (r && r->dev == (uint64_t)dir->st_dev && r->ino == (uint64_t)dir->st_ino) {
+                rec = r;
+                break;
+            }
+        }
+    }
+
+    if (!rec || rec->mtime_sec != dir->st_mtim.tv_sec || rec->mtime_nsec != dir->st_mtim.tv_nsec ||
+        rec->ctime_sec != dir->st_ctim.tv_sec || rec->ctime_nsec != dir->st_ctim.tv_nsec ||
+        (rec->mask & mask) != mask) {
+        __atomic_add_fetch(&snap.misses, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    char *p = (char *)(rec + 1);
+    l->slots = rec->mask ? (struct stat_slot *)p : NULL;
+    if (rec->mask)
+        p += rec->count * sizeof(struct stat_slot);
+    l->ents = (struct file_entry *)p;
+    l->names = p + rec->count * sizeof(struct file_entry);
+    l->count = rec->count;
+    l->max_width = rec->max_width;
+    l->blocks = 0;
+
+    // Never trust an offset out of the file, or a type that is no DT_* value
+    for (size_t i = 0; i < l->count; i++) {
+        const struct file_entry *fe = &l->ents[i];
+        if ((uint64_t)fe->name_off + fe->name_len >= rec->names_len ||
+            l->names[fe->name_off + fe->name_len] != '\0' || fe->type > 15 ||
+            (rec->mask ? fe->stat_idx >= rec->count : fe->stat_idx != NO_STAT)) {
+            __atomic_add_fetch(&snap.misses, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    }
+    __atomic_add_fetch(&snap.hits, 1, __ATOMIC_RELAXED);
+    stats_listed(l->count);
+    return 0;
+}
+
+// Keep the sorted listing l of the directory dir for the next run. mask is
+// the stat fields in its slots, 0 if it has none.
+void snap_store(const struct stat *dir, unsigned int mask, const struct entry_list *l) {
+    if (dir->st_ctim.tv_sec >= snap.started - 1 || l->count > UINT32_MAX)
+        return;
+    size_t names_len = 0;
+    for (size_t i = 0; i < l->count; i++)
+        names_len += l->ents[i].name_len + 1;
+    if (names_len > UINT32_MAX)
+        return;
+    uint64_t size = snap_record_size(l->count, mask, names_len);
+
+    pthread_mutex_lock(&snap.lock);
+    if (snap.fresh_len + size > snap.fresh_cap) {
+        // Offset 0 marks an empty index slot, so records start at 8 here
+        // as they start after the header in the file
+        size_t cap = snap.fresh_cap ? snap.fresh_cap : ARENA_CHUNK_SIZE;
+        if (!snap.fresh_len)
+            snap.fresh_len = 8;
+        while (cap < snap.fresh_len + size)
+            cap *= 2;
+        char *fresh = realloc(snap.fresh, cap);
+        stats_count(STATS_MALLOCS);
+        if (!fresh) {
+            pthread_mutex_unlock(&snap.lock);
+            return;
+        }
+        snap.fresh = fresh;
+        snap.fresh_cap = cap;
+    }
+
+    struct snap_record *rec = (struct snap_record *)(snap.fresh + snap.fresh_len);
+    memset(rec, 0, size);
+    rec->dev = dir->st_dev;
+    rec->ino = dir->st_ino;
+    rec->mtime_sec = dir->st_mtim.tv_sec;
+    rec->mtime_nsec = dir->st_mtim.tv_nsec;
+    rec->ctime_sec = dir->st_ctim.tv_sec;
+    rec->ctime_nsec = dir->st_ctim.tv_nsec;
+    rec->count = l->count;
+    rec->mask = mask;
+    rec->names_len = names_len;
+    rec->max_width = l->max_width;
+    rec->size = size;
+
+    // Same layout as a parallel task's block: slots, entries, packed names
+    char *p = (char *)(rec + 1);
+    if (mask) {
+        memcpy(p, l->slots, l->count * sizeof(struct stat_slot));
+        p += l->count * sizeof(struct stat_slot);
+    }
+    struct file_entry *ents = (struct file_entry *)p;
+    char *names = p + l->count * sizeof(struct file_entry);
+    size_t names_pos = 0;
+    for (size_t i = 0; i < l->count; i++) {
+        ents[i] = l->ents[i];
+        ents[i].name_off = names_pos;
+        ents[i].flags = 0;
+        if (!mask)
+            ents[i].stat_idx = NO_STAT;
+        memcpy(names + names_pos, entry_name(l, &l->ents[i]), ents[i].name_len + 1);
+        names_pos += ents[i].name_len + 1;
+    }
+
+    snap.fresh_len += size;
+    snap.fresh_count++;
+    pthread_mutex_unlock(&snap.lock);
+}
+
+static int snap_write(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void snap_index_add(uint64_t *index, size_t cap, const struct snap_record *rec, uint64_t off) {
+    size_t i = snap_hash(rec->dev, rec->ino) & (cap - 1);
+    for (size_t n = 0; n < cap && index[i]; n++)
+        i = (i + 1) & (cap - 1);
+    if (!index[i])
+        index[i] = off;
+}
+
+static int snap_index_has(const uint64_t *index, size_t cap, const char *base,
+                          const struct snap_record *rec) {
+    size_t i = snap_hash(rec->dev, rec->ino) & (cap - 1);
+    for (size_t n = 0; n < cap && index[i]; n++, i = (i + 1) & (cap - 1)) {
+        const struct snap_record *r = (const struct snap_record *)(base + index[i]);
+        if (r->dev == rec->dev && r->ino == rec->ino)
+            return 1;
+    }
+    return 0;
+}
+
+// Write the old records that were not replaced and the new ones to a new
+// file, then rename it over the old one.
+void snap_save(void) {
+    if (!snap.fresh_count)
+        return;
+
+    // The new records, indexed by their offset in the fresh buffer
+    size_t fresh_cap = 16;
+    while (fresh_cap < snap.fresh_count * 2)
+        fresh_cap *= 2;
+    uint64_t *fresh_index = calloc(fresh_cap, sizeof(uint64_t));
+    size_t old_count = snap.hdr ? snap.hdr->index_cap : 0;
+    size_t cap = 16;
+    while (cap < (snap.fresh_count + old_count) * 2)
+        cap *= 2;
+    uint64_t *index = calloc(cap, sizeof(uint64_t));
+    size_t tmp_len = strlen(snap.path) + 32;
+    char *tmp = malloc(tmp_len);
+    stats_add(STATS_MALLOCS, 3);
+    if (!fresh_index || !index || !tmp) {
+        perror("malloc failed");
+        free(fresh_index);
+        free(index);
+        free(tmp);
+        return;
+    }
+    for (size_t off = 8; off < snap.fresh_len; off += ((struct snap_record *)(snap.fresh + off))->size)
+        snap_index_add(fresh_index, fresh_cap, (struct snap_record *)(snap.fresh + off), off);
+
+    snprintf(tmp, tmp_len, "%s.%ld", snap.path, (long)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        perror("cache write failed");
+        free(fresh_index);
+        free(index);
+        free(tmp);
+        return;
+    }
+
+    struct snap_header hdr = { .context = snap.context, .index_cap = cap };
+    memcpy(hdr.magic, SNAP_MAGIC, 8);
+    uint64_t off = sizeof(hdr);
+    int err = snap_write(fd, &hdr, sizeof(hdr));
+
+    // Old records that are still there, without per-run entry flags
+    if (snap.hdr) {
+        const uint64_t *old = (const uint64_t *)(snap.map + snap.hdr->records_end);
+        for (size_t i = 0; i < snap.hdr->index_cap && !err; i++) {
+            struct snap_record *rec = old[i] ? snap_record_at(old[i]) : NULL;
+            if (!rec || snap_index_has(fresh_index, fresh_cap, snap.fresh, rec))
+                continue;
+            struct file_entry *ents = (struct file_entry *)((char *)(rec + 1) +
+                (rec->mask ? rec->count * sizeof(struct stat_slot) : 0));
+            for (size_t j = 0; j < rec->count; j++)
+                ents[j].flags = 0;
+            snap_index_add(index, cap, rec, off);
+            err = snap_write(fd, rec, rec->size);
+            off += rec->size;
+        }
+    }
+    for (size_t pos = 8; pos < snap.fresh_len && !err; ) {
+        struct snap_record *rec = (struct snap_record *)(snap.fresh + pos);
+        snap_index_add(index, cap, rec, off);
+        err = snap_write(fd, rec, rec->size);
+        off += rec->size;
+        pos += rec->size;
+    }
+
+    hdr.records_end = off;
+    if (!err)
+        err = snap_write(fd, index, cap * sizeof(uint64_t));
+    if (!err && pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        err = -1;
+    if (close(fd) == -1 || err || rename(tmp, snap.path) == -1) {
+        perror("cache write failed");
+        unlink(tmp);
+    }
+    free(fresh_index);
+    free(index);
+    free(tmp);
+}
+
+void snap_print_stats(void) {
+    if (snap.path)
+        fprintf(stderr, "snapshot cache: %zu hits, %zu misses, %zu saved\n",
+                snap.hits, snap.misses, snap.fresh_count);
+}
@@ -0,0 +1,397 @@
+#include "ls.h"
+
+/*
+ * LS_COLORS
+ *
+ * The color specification is parsed once at startup. Type and permission
+ * rules ("di", "ex", "tw", ...) go into a fixed array indexed by class;
+ * "*SUFFIX" rules go into an open-addressed hash table keyed on the
+ * suffix, except the rare ones that do not start with a dot, which are
+ * checked one by one. Every rule stores its complete start sequence
+ * (lc, code, rc), so coloring a name is a lookup and three writes.
+ *
+ * Suffix hashes are computed from the end of the string backwards, so a
+ * single right-to-left pass over a name hashes every ".suffix" in it; the
+ * longest one in the table wins. As in GNU ls, suffixes match regardless
+ * of ASCII case, an exact match being preferred.
+ */
+enum color_class {
+    C_NORMAL, C_FILE, C_DIR, C_LINK, C_FIFO, C_SOCK, C_BLK, C_CHR, C_ORPHAN,
+    C_EXEC, C_SETUID, C_SETGID, C_STICKY_OTHER_WRITABLE, C_OTHER_WRITABLE, C_STICKY,
+    C_LEFT, C_RIGHT, C_END, C_RESET, C_CLASS_COUNT
+};
+
+static const char color_keys[C_CLASS_COUNT][3] = {
+    "no", "fi", "di", "ln", "pi", "so", "bd", "cd", "or",
+    "ex", "su", "sg", "tw", "ow", "st",
+    "lc", "rc", "ec", "rs"
+};
+
+struct color_rule {
+    char *code;             // SGR parameters as given, NULL if unset
+    char *seq;              // lc + code + rc
+    size_t len;
+};
+
+struct color_ext {
+    char *suffix;           // NULL for an empty slot
+    size_t len;
+    uint64_t hash;
+    struct color_rule rule;
+};
+
+static struct {
+    struct color_rule rules[C_CLASS_COUNT];
+    struct color_ext *exts;         // suffixes starting with '.'
+    size_t ext_cap;
+    size_t ext_used;
+    struct color_ext *others;       // any other suffix, checked linearly
+    size_t nothers;
+    char *end;                      // ec, or lc + rs + rc
+    size_t end_len;
+    unsigned int perm_types;        // 1 << DT_* for types whose rules need permission bits
+} colors;
+
+// Hash of s[0..len), case folded, taken from the last byte backwards.
+static uint64_t suffix_hash_step(uint64_t h, unsigned char c) {
+    if (c >= 'A' && c <= 'Z')
+        c += 'a' - 'A';
+    return (h ^ c) * 1099511628211ULL;
+}
+
+static uint64_t suffix_hash(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    while (len-- > 0)
+        h = suffix_hash_step(h, (unsigned char)s[len]);
+    return h;
+}
+
+// Table entry for a suffix; unless exact, one differing in case will do.
+static struct color_ext *color_ext_find(const char *suffix, size_t len, uint64_t hash, int exact) {
+    struct color_ext *folded = NULL;
+    size_t mask = colors.ext_cap - 1;
+    for (size_t i = hash & mask; colors.exts[i].suffix; i = (i + 1) & mask) {
+        struct color_ext *e = &colors.exts[i];
+        if (e->hash != hash || e->len != len)
+            continue;
+        if (memcmp(e->suffix, suffix, len) == 0)
+            return e;
+        if (!exact && !folded && strncasecmp(e->suffix, suffix, len) == 0)
+            folded = e;
+    }
+    return folded;
+}
+
+static int color_ext_grow(void) {
+    size_t old_cap = colors.ext_cap;
+    struct color_ext *old = colors.exts;
+    size_t cap = old_cap ? 2 * old_cap : COLOR_EXT_MIN;
+    struct color_ext *exts = calloc(cap, sizeof(struct color_ext));
+    stats_count(STATS_MALLOCS);
+    if (!exts)
+        return -1;
+
+    colors.exts = exts;
+    colors.ext_cap = cap;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (!old[i].suffix)
+            continue;
+        size_t j = old[i].hash & (cap - 1);
+        while (exts[j].suffix)
+            j = (j + 1) & (cap - 1);
+        exts[j] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+// The rule for a suffix, added if it is new. Returns NULL if out of memory.
+static struct color_rule *color_ext_rule(char *suffix, size_t len) {
+    if (suffix[0] != '.') {
+        struct color_ext *others = realloc(colors.others,
+                                           (colors.nothers + 1) * sizeof(struct color_ext));
+        stats_count(STATS_MALLOCS);
+        if (!others)
+            return NULL;
+        colors.others = others;
+        struct color_ext *e = &others[colors.nothers++];
+        memset(e, 0, sizeof(*e));
+        e->suffix = suffix;
+        e->len = len;
+        return &e->rule;
+    }
+
+    uint64_t hash = suffix_hash(suffix, len);
+    struct color_ext *e = colors.ext_cap ? color_ext_find(suffix, len, hash, 1) : NULL;
+    if (e)
+        return &e->rule;
+    if (2 * (colors.ext_used + 1) > colors.ext_cap && color_ext_grow() == -1)
+        return NULL;
+
+    size_t i = hash & (colors.ext_cap - 1);
+    while (colors.exts[i].suffix)
+        i = (i + 1) & (colors.ext_cap - 1);
+    e = &colors.exts[i];
+    e->suffix = suffix;
+    e->len = len;
+    e->hash = hash;
+    colors.ext_used++;
+    return &e->rule;
+}
+
+// Decode the escapes dircolors allows (\e, \n, \NNN, ^X, ...) in place, up
+// to the first unescaped character from stops. *end gets the end of the
+// decoded text and *src moves past the stop. Returns the stop character,
+// or 0 at the end of the string.
+static char color_unescape(char **src, const char *stops, char **end) {
+    char *in = *src, *out = *src;
+    while (*in && !strchr(stops, *in)) {
+        if (*in == '\\' && in[1]) {
+            in++;
+            if (*in >= '0' && *in <= '7') {
+                int v = 0;
+                for (int k = 0; k < 3 && *in >= '0' && *in <= '7'; k++)
+                    v = v * 8 + (*in++ - '0');
+                *out++ = v;
+                continue;
+            }
+            switch (*in) {
+                case 'a': *out++ = '\a'; break;
+                case 'b': *out++ = '\b'; break;
+                case 'e': *out++ = 27; break;
+                case 'f': *out++ = '\f'; break;
+                case 'n': *out++ = '\n'; break;
+                case 'r': *out++ = '\r'; break;
+                case 't': *out++ = '\t'; break;
+                case 'v': *out++ = '\v'; break;
+                case '_': *out++ = ' '; break;
+                default:  *out++ = *in; break;
+            }
+            in++;
+        } else if (*in == '^' && in[1]) {
+            *out++ = in[1] == '?' ? 127 : (in[1] & 0x1f);
+            in += 2;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    char stop = *in;
+    *end = out;
+    *src = stop ? in + 1 : in;
+    return stop;
+}
+
+// Parse one specification, KEY=VALUE pairs separated by ':'. spec is
+// modified and must outlive the rules. Malformed entries are skipped.
+static void color_parse(char *spec) {
+    char *p = spec;
+    while (*p) {
+        char *key = p, *key_end, *value, *value_end;
+        if (color_unescape(&p, ":=", &key_end) != '=')
+            continue;
+        value = p;
+        color_unescape(&p, ":", &value_end);
+        *key_end = '\0';
+        *value_end = '\0';
+
+        struct color_rule *rule = NULL;
+        if (key[0] == '*' && key[1]) {
+            rule = color_ext_rule(key + 1, key_end - key - 1);
+        } else {
+            for (int c = 0; c < C_CLASS_COUNT; c++) {
+                if (strcmp(key, color_keys[c]) == 0)
+                    rule = &colors.rules[c];
+            }
+        }
+
+        // "ln=target" (color links like their target) is not supported
+        if (rule && !(rule == &colors.rules[C_LINK] && strcmp(value, "target") == 0))
+            rule->code = value;
+    }
+}
+
+// Build the start sequence of a rule once lc and rc are known. An empty
+// code (or "0", "00") leaves names of that class uncolored.
+static void color_compose(struct color_rule *r, const char *lc, const char *rc) {
+    if (!r->code || !*r->code || strspn(r->code, "0") == strlen(r->code)) {
+        r->seq = NULL;
+        return;
+    }
+    size_t lc_len = strlen(lc), code_len = strlen(r->code), rc_len = strlen(rc);
+    r->seq = malloc(lc_len + code_len + rc_len + 1);
+    stats_count(STATS_MALLOCS);
+    if (!r->seq) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(r->seq, lc, lc_len);
+    memcpy(r->seq + lc_len, r->code, code_len);
+    memcpy(r->seq + lc_len + code_len, rc, rc_len + 1);
+    r->len = lc_len + code_len + rc_len;
+}
+
+// Parse LS_COLORS, or the defaults when it is not set.
+void colors_init(void) {
+    static char type_defaults[] = DEFAULT_TYPE_COLORS;
+    static char ext_defaults[] = DEFAULT_EXT_COLORS;
+    const char *env = getenv("LS_COLORS");
+
+    color_parse(type_defaults);
+    if (env) {
+        char *spec = strdup(env);
+        stats_count(STATS_MALLOCS);
+        if (spec)
+            color_parse(spec);
+    } else {
+        color_parse(ext_defaults);
+    }
+
+    const char *lc = colors.rules[C_LEFT].code ? colors.rules[C_LEFT].code : "\033[";
+    const char *rc = colors.rules[C_RIGHT].code ? colors.rules[C_RIGHT].code : "m";
+    const char *rs = colors.rules[C_RESET].code ? colors.rules[C_RESET].code : "0";
+    for (int c = 0; c < C_LEFT; c++)
+        color_compose(&colors.rules[c], lc, rc);
+    for (size_t i = 0; i < colors.ext_cap; i++) {
+        if (colors.exts[i].suffix)
+            color_compose(&colors.exts[i].rule, lc, rc);
+    }
+    for (size_t i = 0; i < colors.nothers; i++)
+        color_compose(&colors.others[i].rule, lc, rc);
+
+    // Names end with ec, or by default with the reset code
+    if (colors.rules[C_END].code) {
+        colors.end = colors.rules[C_END].code;
+        colors.end_len = strlen(colors.end);
+    } else {
+        size_t lc_len = strlen(lc), rs_len = strlen(rs), rc_len = strlen(rc);
+        colors.end = malloc(lc_len + rs_len + rc_len + 1);
+        stats_count(STATS_MALLOCS);
+        if (!colors.end) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(colors.end, lc, lc_len);
+        memcpy(colors.end + lc_len, rs, rs_len);
+        memcpy(colors.end + lc_len + rs_len, rc, rc_len + 1);
+        colors.end_len = lc_len + rs_len + rc_len;
+    }
+
+    if (colors.rules[C_EXEC].seq || colors.rules[C_SETUID].seq || colors.rules[C_SETGID].seq)
+        colors.perm_types |= 1U << DT_REG;
+    if (colors.rules[C_STICKY_OTHER_WRITABLE].seq || colors.rules[C_OTHER_WRITABLE].seq ||
+        colors.rules[C_STICKY].seq)
+        colors.perm_types |= 1U << DT_DIR;
+}
+
+// Longest matching suffix rule for a name, or NULL.
+static const struct color_rule *color_ext_lookup(const char *name, size_t len) {
+    const struct color_rule *found = NULL;
+    if (colors.ext_used) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = len; i-- > 0; ) {
+            h = suffix_hash_step(h, (unsigned char)name[i]);
+            if (name[i] != '.')
+                continue;
+            struct color_ext *e = color_ext_find(name + i, len - i, h, 0);
+            if (e && e->rule.seq)
+                found = &e->rule;
+        }
+    }
+    for (size_t i = 0; i < colors.nothers && !found; i++) {
+        struct color_ext *e = &colors.others[i];
+        if (e->len <= len && e->rule.seq &&
+            strncasecmp(name + len - e->len, e->suffix, e->len) == 0)
+            found = &e->rule;
+    }
+    return found;
+}
+
+static const struct color_rule *color_rule_for(int c) {
+    return colors.rules[c].seq ? &colors.rules[c] : NULL;
+}
+
+// Color of an entry with the given mode; NULL means print it plain.
+static const struct color_rule *get_color(const char *name, size_t len, mode_t mode,
+                                   unsigned char flags) {
+    const struct color_rule *r = NULL;
+    if (S_ISREG(mode)) {
+        if (mode & S_ISUID)
+            r = color_rule_for(C_SETUID);
+        if (!r && (mode & S_ISGID))
+            r = color_rule_for(C_SETGID);
+        if (!r && (mode & (S_IXUSR | S_IXGRP | S_IXOTH)))
+            r = color_rule_for(C_EXEC);
+        if (!r)
+            r = color_ext_lookup(name, len);
+        if (!r)
+            r = color_rule_for(C_FILE);
+    } else if (S_ISDIR(mode)) {
+        if ((mode & S_ISVTX) && (mode & S_IWOTH))
+            r = color_rule_for(C_STICKY_OTHER_WRITABLE);
+        if (!r && (mode & S_IWOTH))
+            r = color_rule_for(C_OTHER_WRITABLE);
+        if (!r && (mode & S_ISVTX))
+            r = color_rule_for(C_STICKY);
+        if (!r)
+            r = color_rule_for(C_DIR);
+    } else if (S_ISLNK(mode)) {
+        if (flags & ENTRY_ORPHAN)
+            r = color_rule_for(C_ORPHAN);
+        if (!r)
+            r = color_rule_for(C_LINK);
+    } else if (S_ISFIFO(mode)) {
+        r = color_rule_for(C_FIFO);
+    } else if (S_ISSOCK(mode)) {
+        r = color_rule_for(C_SOCK);
+    } else if (S_ISBLK(mode)) {
+        r = color_rule_for(C_BLK);
+    } else if (S_ISCHR(mode)) {
+        r = color_rule_for(C_CHR);
+    }
+    return r ? r : color_rule_for(C_NORMAL);
+}
+
+// Find out what the color of an entry depends on: the mode, with the
+// permission bits only for types whose rules look at them, and whether a
+// symlink is dangling only if orphans have a color. Returns the mode, or
+// 0 if the file cannot be inspected.
+mode_t color_prepare(const struct entry_list *l, struct file_entry *fe) {
+    int need_perms = fe->type == DT_UNKNOWN ||
+                     (fe->type < 32 && ((colors.perm_types >> fe->type) & 1));
+    mode_t mode = entry_mode(l, fe, need_perms);
+
+    if (S_ISLNK(mode) && colors.rules[C_ORPHAN].seq && l->dirfd >= 0 &&
+        !(fe->flags & ENTRY_LINK_CHECKED)) {
+        fe->flags |= ENTRY_LINK_CHECKED;
+        stats_count(STATS_ACCESS);
+        if (faccessat(l->dirfd, entry_name(l, fe), F_OK, 0) == -1)
+            fe->flags |= ENTRY_ORPHAN;
+    }
+    return mode;
+}
+
+void print_colored(const struct entry_list *l, struct file_entry *fe) {
+    const char *name = entry_name(l, fe);
+    if (!use_color) {
+        out_write(name, fe->name_len);
+        return;
+    }
+
+    mode_t mode = color_prepare(l, fe);
+    if (!mode) {
+        // Without a dirfd the failure was already reported when it was read
+        if (l->dirfd >= 0)
+            perror("lstat failed");
+        out_write(name, fe->name_len);
+        return;
+    }
+
+    const struct color_rule *color = get_color(name, fe->name_len, mode, fe->flags);
+    if (!color) {
+        out_write(name, fe->name_len);
+        return;
+    }
+    out_write(color->seq, color->len);
+    out_write(name, fe->name_len);
+    out_write(colors.end, colors.end_len);
+}
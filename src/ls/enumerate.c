@@ -0,0 +1,224 @@
+#include "ls.h"
+
+/*
+ * Enumerate stage
+ *
+ * A directory is either read whole into a dir_buffer in the arena, for
+ * listings that are sorted, or a buffer at a time through a dir_stream
+ * for -U. Both hand out records laid out like linux_dirent64, straight
+ * from getdents64 or, with USE_READDIR, copied out of readdir().
+ * collect_entries() turns a dir_buffer into the entry array every later
+ * stage works on.
+ */
+
+// Open a directory relative to an open parent, so only one path component
+// is resolved. Pass AT_FDCWD to open a path given on the command line.
+int open_directory(int parent_fd, const char *name) {
+    stats_count(STATS_OPEN);
+    return openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+int close_directory(int fd) {
+    stats_count(STATS_CLOSE);
+    return close(fd);
+}
+
+// fstat() of an open directory, to tell whether it is the one expected
+int stat_directory(int fd, struct stat *st) {
+    stats_count(STATS_FSTAT);
+    return fstat(fd, st);
+}
+
+static int read_records(struct arena *a, int fd, struct dir_buffer *db) {
+    char *block = NULL;
+    size_t len = 0;
+
+#ifdef USE_READDIR
+    int dup_fd = dup(fd);
+    DIR *dir = dup_fd == -1 ? NULL : fdopendir(dup_fd);
+    if (!dir) {
+        if (dup_fd != -1)
+            close(dup_fd);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t name_len = strlen(entry->d_name);
+        size_t reclen = (offsetof(struct dir_record, d_name) + name_len + 1 + 7) & ~(size_t)7;
+        block = arena_extend(a, block, len, reclen);
+        if (!block) {
+            closedir(dir);
+            errno = ENOMEM;
+            return -1;
+        }
+
+        struct dir_record *rec = (struct dir_record *)(block + len);
+        rec->d_ino = entry->d_ino;
+        rec->d_off = 0;
+        rec->d_reclen = reclen;
+        rec->d_type = entry->d_type;
+        memcpy(rec->d_name, entry->d_name, name_len + 1);
+        len += reclen;
+    }
+
+    closedir(dir);
+#else
+    for (;;) {
+        block = arena_extend(a, block, len, DIRBUF_SLACK);
+        if (!block) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        long n = syscall(SYS_getdents64, fd, block + len, arena_block_room(a, len));
+        stats_count(STATS_GETDENTS);
+        if (n == -1)
+            return -1;
+        if (n == 0)
+            break;
+        len += n;
+    }
+#endif
+
+    if (block)
+        arena_close_block(a, len);
+    db->data = block;
+    db->len = len;
+    return 0;
+}
+
+// Read every record of the open directory fd into db, allocated from the
+// arena. The fd stays open. Returns 0 or -1 with errno set.
+int read_directory(struct arena *a, int fd, struct dir_buffer *db) {
+    int phase = stats_begin(PHASE_ENUMERATE);
+    int rc = read_records(a, fd, db);
+    stats_end(phase);
+    return rc;
+}
+
+// Walk the records of db; *pos starts at 0. Returns NULL at the end.
+static struct dir_record *dir_buffer_next(struct dir_buffer *db, size_t *pos) {
+    if (*pos >= db->len)
+        return NULL;
+    struct dir_record *rec = (struct dir_record *)(db->data + *pos);
+    *pos += rec->d_reclen;
+    return rec;
+}
+
+// Names collect_entries() leaves out: dotfiles, unless show_all (-f). With
+// -s they are kept anyway, as they count towards the sizes; they are
+// dropped later, before listing.
+static int entry_hidden(const char *name, int show_all) {
+    if (name[0] != '.' || show_all)
+        return 0;
+    return !show_blocks || name[1] == '\0' || (name[1] == '.' && name[2] == '\0');
+}
+
+// Build the entry array of a directory read into db, in directory order,
+// with the dotfiles if show_all is set. The array is allocated from a;
+// names stay in db. dirfd and slots are left for the caller. Returns 0 or
+// -1 if out of memory.
+int collect_entries(struct arena *a, struct dir_buffer *db, int show_all, struct entry_list *l) {
+    struct dir_record *rec;
+    size_t pos = 0;
+    size_t count = 0;
+    size_t max_width = 0;
+
+    while ((rec = dir_buffer_next(db, &pos)) != NULL) {
+        if (!entry_hidden(rec->d_name, show_all))
+            count++;
+    }
+
+    struct file_entry *files = arena_alloc(a, (count ? count : 1) * sizeof(struct file_entry));
+    if (!files)
+        return -1;
+
+    count = 0;
+    pos = 0;
+    while ((rec = dir_buffer_next(db, &pos)) != NULL) {
+        if (entry_hidden(rec->d_name, show_all)) continue;
+
+        // Names stay in the directory buffer, no copy
+        struct file_entry *fe = &files[count++];
+        size_t len = strlen(rec->d_name);
+        fe->ino = rec->d_ino;
+        fe->name_off = rec->d_name - db->data;
+        fe->stat_idx = NO_STAT;
+        fe->mode = 0;
+        fe->name_len = len;
+        fe->width = display_width(rec->d_name, len);
+        fe->type = rec->d_type;
+        fe->flags = 0;
+        if (fe->width > max_width)
+            max_width = fe->width;
+    }
+
+    l->ents = files;
+    l->count = count;
+    l->names = db->data;
+    l->slots = NULL;
+    l->max_width = max_width;
+    l->blocks = 0;
+    stats_listed(count);
+    return 0;
+}
+
+// Stream the entries of the open directory fd. The fd stays open.
+int dir_stream_open(struct dir_stream *ds, int fd, char *buf) {
+    ds->err = 0;
+#ifdef USE_READDIR
+    ds->rec = (struct dir_record *)buf;
+    int dup_fd = dup(fd);
+    ds->dir = dup_fd == -1 ? NULL : fdopendir(dup_fd);
+    if (!ds->dir && dup_fd != -1)
+        close(dup_fd);
+    return ds->dir ? 0 : -1;
+#else
+    ds->buf = buf;
+    ds->len = ds->pos = 0;
+    ds->fd = fd;
+    return 0;
+#endif
+}
+
+// Next record of the directory, or NULL at the end or on an error, which
+// is left in ds->err.
+struct dir_record *dir_stream_next(struct dir_stream *ds) {
+#ifdef USE_READDIR
+    errno = 0;
+    struct dirent *entry = readdir(ds->dir);
+    if (!entry) {
+        ds->err = errno;
+        return NULL;
+    }
+    ds->rec->d_ino = entry->d_ino;
+    ds->rec->d_type = entry->d_type;
+    strcpy(ds->rec->d_name, entry->d_name);
+    return ds->rec;
+#else
+    if (ds->pos >= ds->len) {
+        int phase = stats_begin(PHASE_ENUMERATE);
+        long n = syscall(SYS_getdents64, ds->fd, ds->buf, STREAM_BUF_SIZE);
+        stats_end(phase);
+        stats_count(STATS_GETDENTS);
+        if (n <= 0) {
+            ds->err = n == 0 ? 0 : errno;
+            return NULL;
+        }
+        ds->len = n;
+        ds->pos = 0;
+    }
+    struct dir_record *rec = (struct dir_record *)(ds->buf + ds->pos);
+    ds->pos += rec->d_reclen;
+    return rec;
+#endif
+}
+
+void dir_stream_close(struct dir_stream *ds) {
+#ifdef USE_READDIR
+    closedir(ds->dir);
+#else
+    (void)ds;
+#endif
+}
@@ -0,0 +1,178 @@
+#include "ls.h"
+
+/*
+ * Column layout
+ *
+ * As in GNU ls, every column is only as wide as its widest name (plus
+ * SPACING between columns), so one long name no longer forces every
+ * column to its width. The layout uses the fewest rows whose lines stay
+ * shorter than the terminal, so the last column never touches the edge.
+ *
+ * Down columns (the default) a column with r rows covers a contiguous run
+ * of entries, so its width is a range maximum. Range maxima come from a
+ * sparse table whose level k holds the maxima of runs of 2^k entries;
+ * trying r rows costs O(n / r), so trying every candidate is O(n log n).
+ * Only the level for the current r is kept, built in place from the one
+ * below, and the short last column is read from suffix maxima.
+ *
+ * Every entry may be extra cells wider than its name, for the -s size in
+ * front of it; widths are summed in size_t, never in the entry itself.
+ */
+
+static int get_terminal_width() {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1)
+        return 80;
+    return ws.ws_col;
+}
+
+// Display width of a name of len bytes in terminal cells. Plain ASCII,
+// checked eight bytes at a time, is as wide as it is long; anything else is
+// decoded with mbrtowc() and measured with wcwidth().
+size_t display_width(const char *name, size_t len) {
+    uint64_t high = 0;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, name + i, 8);
+        high |= word;
+    }
+    for (; i < len; i++)
+        high |= (unsigned char)name[i];
+    if (!(high & 0x8080808080808080ULL) || MB_CUR_MAX == 1)
+        return len;
+
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    size_t width = 0;
+    for (i = 0; i < len; ) {
+        wchar_t wc;
+        size_t n = mbrtowc(&wc, name + i, len - i, &state);
+        if (n == (size_t)-1 || n == (size_t)-2) {
+            // An invalid byte is printed as is and takes one cell
+            memset(&state, 0, sizeof(state));
+            width++;
+            i++;
+            continue;
+        }
+        int w = wcwidth(wc);
+        width += w < 0 ? 1 : (size_t)w;
+        i += n ? n : 1;
+    }
+    return width;
+}
+
+static size_t term_width_cached = 0;
+
+size_t terminal_width(void) {
+    if (!term_width_cached)
+        term_width_cached = get_terminal_width();
+    return term_width_cached ? term_width_cached : 80;
+}
+
+// Columns that could fit at best, each name at least one cell wide.
+size_t layout_max_cols(size_t count, size_t width) {
+    size_t cols = width / (1 + SPACING);
+    if (cols > count)
+        cols = count;
+    return cols ? cols : 1;
+}
+
+// Fewest rows for a vertical layout of the entries, each extra cells wider
+// than its name; col_width[j] receives the widest entry of column j.
+// col_width must have room for max_cols.
+size_t layout_vertical(const struct entry_list *l, size_t extra, size_t width, uint16_t *col_width) {
+    const struct file_entry *files = l->ents;
+    size_t count = l->count;
+    size_t max_cols = layout_max_cols(count, width);
+    size_t rows = (count + max_cols - 1) / max_cols;
+
+    // With every column at the widest name this many rows surely fit
+    size_t uniform_cols = (width + SPACING - 1) / (l->max_width + extra + SPACING);
+    size_t last_rows = uniform_cols ? (count + uniform_cols - 1) / uniform_cols : count;
+    if (last_rows < rows)
+        last_rows = rows;
+
+    uint16_t *level = arena_alloc(&arena, count * sizeof(uint16_t));
+    uint16_t *suffix = arena_alloc(&arena, count * sizeof(uint16_t));
+    if (!level || !suffix)
+        rows = last_rows;
+    else {
+        for (size_t i = 0; i < count; i++)
+            level[i] = files[i].width + extra;
+        suffix[count - 1] = level[count - 1];
+        for (size_t i = count - 1; i-- > 0; )
+            suffix[i] = level[i] > suffix[i + 1] ? level[i] : suffix[i + 1];
+    }
+
+    size_t span = 1;        // level[i] is the maximum of entries i .. i + span - 1
+    for (; rows < last_rows; rows++) {
+        while (2 * span <= rows) {
+            for (size_t i = 0; i + 2 * span <= count; i++) {
+                if (level[i + span] > level[i])
+                    level[i] = level[i + span];
+            }
+            span *= 2;
+        }
+
+        // Only row counts that some column count produces, as GNU ls lays out
+        size_t cols = (count + rows - 1) / rows;
+        if ((count + cols - 1) / cols != rows)
+            continue;
+
+        size_t total = (cols - 1) * SPACING;
+        size_t j = 0;
+        for (; j + 1 < cols && total < width; j++) {
+            size_t start = j * rows, end = start + rows;
+            uint16_t a = level[start], b = level[end - span];
+            col_width[j] = a > b ? a : b;
+            total += col_width[j];
+        }
+        col_width[cols - 1] = suffix[(cols - 1) * rows];
+        total += col_width[cols - 1];
+        if (total < width)
+            return rows;
+    }
+
+    // The uniform layout, or the allocation failed: fill in the widths directly
+    size_t cols = (count + rows - 1) / rows;
+    for (size_t j = 0; j < cols; j++)
+        col_width[j] = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (files[i].width + extra > col_width[i / rows])
+            col_width[i / rows] = files[i].width + extra;
+    }
+    return rows;
+}
+
+// Most columns for a row-by-row (-x) layout of entries extra cells wider
+// than their names. Entry i is in column i % cols, so there are no runs to
+// share; each candidate is a pass that stops as soon as the row is too wide.
+size_t layout_horizontal(const struct entry_list *l, size_t extra, size_t width, uint16_t *col_width) {
+    const struct file_entry *files = l->ents;
+    size_t count = l->count;
+    size_t cols = layout_max_cols(count, width);
+    for (; cols > 1; cols--) {
+        size_t total = (cols - 1) * SPACING;
+        for (size_t j = 0; j < cols; j++) {
+            col_width[j] = files[j].width + extra;
+            total += col_width[j];
+        }
+        for (size_t i = cols; i < count && total < width; i++) {
+            size_t j = i % cols, w = files[i].width + extra;
+            if (w > col_width[j]) {
+                total += w - col_width[j];
+                col_width[j] = w;
+            }
+        }
+        if (total < width)
+            return cols;
+    }
+
+    col_width[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (files[i].width + extra > col_width[0])
+            col_width[0] = files[i].width + extra;
+    }
+    return 1;
+}
@@ -0,0 +1,435 @@
+#ifndef LS_H
+#define LS_H
+
+#define _GNU_SOURCE     // statx()
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <grp.h>
+#include <time.h>
+#include <locale.h>
+#include <langinfo.h>
+#include <wchar.h>
+#include <errno.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/vfs.h>
+#include <sys/inotify.h>
+#endif
+
+// Build with -DUSE_READDIR to read directories through readdir() instead
+// of raw getdents64 (the only option on non-Linux systems).
+#if !defined(__linux__) && !defined(USE_READDIR)
+#define USE_READDIR
+#endif
+
+// Without statx() the masks below only tell fstatat() callers what they need
+#if defined(__linux__) && defined(STATX_TYPE)
+#define HAVE_STATX
+#elif !defined(STATX_TYPE)
+#define STATX_TYPE  0x0001U
+#define STATX_MODE  0x0002U
+#define STATX_NLINK 0x0004U
+#define STATX_UID   0x0008U
+#define STATX_GID   0x0010U
+#define STATX_MTIME 0x0040U
+#define STATX_INO   0x0100U
+#define STATX_SIZE  0x0200U
+#define STATX_BLOCKS 0x0400U
+#define STATX_BTIME 0x0800U
+#endif
+#define STATX_LONG  (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | \
+                     STATX_SIZE | STATX_MTIME)
+#define STATX_USAGE (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | STATX_BLOCKS)
+
+#define SPACING 2
+#define ARENA_CHUNK_SIZE (1 << 20)  // arena chunk, also the initial getdents64 buffer
+#define MAX_THREADS   256
+#define STAT_THREADS  8             // default stat prefetch threads for -l
+#define STAT_PREFETCH_MIN 64        // smaller directories are stat'ed serially
+#define STAT_BATCH    32            // entries claimed per prefetch step
+#define NAME_CACHE_SIZE 64          // initial uid/gid cache slots
+#define OUTBUF_SIZE   (256 << 10)   // stdout buffer, flushed with write()
+#define DIRBUF_SLACK  (64 << 10)    // grow the buffer when less than this is left for the next batch
+#define RADIX_SORT_MIN 256          // smaller directories are sorted with qsort()
+#define STREAM_BUF_SIZE (64 << 10)  // getdents64 buffer for unsorted streaming
+#define MAX_DIR_FDS   64            // default cap on directory fds held open by -R
+#define MAX_UNPRINTED 1024          // directories parallel -R reads ahead of the printer
+#define COLOR_EXT_MIN 16            // initial LS_COLORS suffix table slots
+#define TIME_CACHE_SIZE 256         // days a time formatting cache holds, a power of two
+#define TIME_MONTH_MAX 32           // bytes of a padded month abbreviation
+#define TIME_TEXT_MAX  64           // bytes of a formatted time
+
+// Colors used when LS_COLORS is not set; LS_COLORS replaces the suffixes
+#define DEFAULT_TYPE_COLORS "di=0;34:ln=0;35:pi=7:so=7:bd=7:cd=7:ex=0;32"
+#define DEFAULT_EXT_COLORS  "*.zip=0;31:*.tar=0;31:*.gz=0;31"
+
+#define NO_STAT UINT32_MAX
+
+// One directory entry, filled in once while the directory is read. The
+// name is an offset into the directory's name buffer, so a record is 24
+// bytes and the array of a directory is one contiguous block.
+struct file_entry {
+    uint64_t ino;           // d_ino
+    uint32_t name_off;      // NUL-terminated name at entry_list.names + name_off
+    uint32_t stat_idx;      // index into entry_list.slots, NO_STAT if not stat'ed
+    mode_t mode;            // from lstat(), 0 until it is needed
+    unsigned char name_len; // names are at most 255 bytes...
+    unsigned char width;    // ...and never wider than they are long
+    unsigned char type;     // DT_* value from readdir, DT_UNKNOWN if not filled in
+    unsigned char flags;    // ENTRY_* bits
+};
+
+#define ENTRY_LINK_CHECKED 0x1  // symlink target looked up for the "or" color
+#define ENTRY_ORPHAN       0x2  // symlink target is missing
+
+// Every mode from DISPLAY_LONG on prints stat fields
+enum display_mode { DISPLAY_VERTICAL, DISPLAY_HORIZONTAL, DISPLAY_LONG, DISPLAY_NDJSON, DISPLAY_NUL };
+
+enum time_field { TIME_MTIME, TIME_BIRTH };
+
+// Sort orders; -t and -S sort on stat fields, so every entry is stat'ed
+enum sort_key { SORT_NAME, SORT_TIME, SORT_SIZE, SORT_EXTENSION, SORT_VERSION };
+
+enum time_style {
+    TIME_STYLE_DEFAULT,     // "Mon DD HH:MM", or "Mon DD  YYYY" past six months
+    TIME_STYLE_LOCALE,      // the same with the locale's month names
+    TIME_STYLE_ISO,         // "MM-DD HH:MM", or "YYYY-MM-DD "
+    TIME_STYLE_LONG_ISO,    // "YYYY-MM-DD HH:MM"
+    TIME_STYLE_FULL_ISO     // "YYYY-MM-DD HH:MM:SS.NNNNNNNNN +hhmm"
+};
+
+// lstat() result for one entry of a long listing. Only the fields in
+// long_mask are filled in.
+struct stat_slot {
+    struct stat st;
+    struct timespec btime;  // tv_nsec is -1 if the filesystem has no birth time
+    int err;                // errno from lstat, 0 on success
+    uint64_t sort_key;      // -t, -S: the entry's sort key, see stat_sort_key()
+};
+
+// The entries of one directory. Stat, sort, layout, color and recursion
+// all work on this one array; sorting moves the records, which carry their
+// name and stat payload by offset and index.
+struct entry_list {
+    struct file_entry *ents;
+    size_t count;
+    const char *names;          // base of every name_off
+    struct stat_slot *slots;    // stat payloads for -l, NULL otherwise
+    size_t max_width;
+    int dirfd;                  // -1 once the directory is closed
+    blkcnt_t blocks;            // -s: everything under the directory, in 512-byte units
+};
+
+static inline const char *entry_name(const struct entry_list *l, const struct file_entry *fe) {
+    return l->names + fe->name_off;
+}
+
+// One directory record, laid out like the kernel's struct linux_dirent64 so
+// getdents64 output can be walked in place.
+struct dir_record {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Holds every record of one directory. Names handed out by dir_buffer_next()
+// point into data, which lives in the arena until the directory is released.
+struct dir_buffer {
+    char *data;
+    size_t len;
+};
+
+// Stack-style bump allocator. Each directory takes a mark on entry and
+// releases back to it on exit, so chunks are reused across the whole walk
+// instead of being malloc'd and freed per directory.
+struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct arena {
+    struct arena_chunk *head;       // chunk currently being allocated from
+    struct arena_chunk *free_list;  // released chunks kept for reuse
+    size_t in_use;                  // bytes handed out and not yet released
+    size_t peak;
+    size_t reserved;                // bytes obtained from malloc
+    size_t chunk_mallocs;
+};
+
+struct arena_mark {
+    struct arena_chunk *chunk;
+    size_t used;
+    size_t in_use;
+};
+
+
+// Streams the records of one directory a buffer at a time (-U)
+struct dir_stream {
+#ifdef USE_READDIR
+    DIR *dir;
+    struct dir_record *rec;     // scratch record for the current entry
+#else
+    int fd;
+    char *buf;
+    size_t len;
+    size_t pos;
+#endif
+    int err;                    // errno of a failed read, 0 if there was none
+};
+
+struct name_cache_slot {
+    unsigned int id;
+    int used;
+    char *name;             // NULL if the id has no name
+};
+
+struct name_cache {
+    struct name_cache_slot *slots;
+    size_t cap;             // power of two
+    size_t len;
+    size_t hits;
+    size_t misses;
+};
+
+// One local day of a time formatting cache: its date, formatted for
+// recent and for old times, and where it starts and ends
+struct time_bucket {
+    time_t start, end;          // end is 0 for an empty bucket
+    long gmtoff;
+    int regular;                // one UTC offset all day long
+    unsigned char recent_len, old_len;
+    char recent[TIME_MONTH_MAX + 16];
+    char old[TIME_MONTH_MAX + 16];
+};
+
+struct time_cache {
+    struct time_bucket buckets[TIME_CACHE_SIZE];
+    long gmtoff_hint;           // of the last day computed, to find the day of a time
+    time_t now;                 // the six-month rule is relative to this
+};
+
+// An entry as the sort engine orders it: by key, then str, then idx
+struct sort_rec {
+    uint64_t key;
+    const char *str;
+    size_t idx;
+};
+
+struct walk_stats {
+    size_t max_depth;
+    size_t reopens;
+};
+
+struct usage_counts {
+    size_t entries;             // stat'ed and summed
+    size_t links;               // hard links not counted again
+};
+
+enum stats_phase {
+    PHASE_IDLE, PHASE_ENUMERATE, PHASE_STAT, PHASE_SORT, PHASE_LAYOUT, PHASE_RENDER,
+    PHASE_WRITE, PHASE_COUNT
+};
+
+enum stats_counter {
+    STATS_OPEN, STATS_GETDENTS, STATS_STAT, STATS_FSTAT, STATS_FSTATFS, STATS_ACCESS,
+    STATS_WRITE, STATS_CLOSE, STATS_DIRS, STATS_ENTRIES, STATS_BYTES, STATS_MALLOCS, STATS_COUNTERS
+};
+
+// --stats counts of one thread
+struct thread_stats {
+    uint64_t counters[STATS_COUNTERS];
+    uint64_t phase_ns[PHASE_COUNT];
+    uint64_t peak_entries;      // largest entry array built
+    int phase;                  // being timed since phase_start
+    uint64_t phase_start;
+    struct thread_stats *next;
+};
+
+// Options, set by main() before anything is listed
+extern int show_stats;
+extern int use_color;
+extern int show_blocks;
+extern int stat_threads;
+extern int time_field;
+extern int time_style;
+extern unsigned int long_mask;
+extern int max_dir_fds;
+extern int sort_collate;
+extern int sort_key;
+extern int sort_reverse;
+extern size_t top_count;
+extern int out_interactive;
+
+extern struct arena arena;
+extern struct arena name_arena;
+extern struct walk_stats walk_stats;
+extern struct name_cache user_cache, group_cache;
+extern struct usage_counts usage_stats;
+
+// arena.c
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_extend(struct arena *a, char *block, size_t len, size_t need);
+size_t arena_block_room(struct arena *a, size_t len);
+void arena_close_block(struct arena *a, size_t len);
+struct arena_mark arena_get_mark(struct arena *a);
+void arena_release(struct arena *a, struct arena_mark m);
+
+// enumerate.c
+int open_directory(int parent_fd, const char *name);
+int close_directory(int fd);
+int stat_directory(int fd, struct stat *st);
+int read_directory(struct arena *a, int fd, struct dir_buffer *db);
+int collect_entries(struct arena *a, struct dir_buffer *db, int show_all, struct entry_list *l);
+int dir_stream_open(struct dir_stream *ds, int fd, char *buf);
+struct dir_record *dir_stream_next(struct dir_stream *ds);
+void dir_stream_close(struct dir_stream *ds);
+
+// stat.c
+void stat_dir_begin(int dirfd);
+mode_t entry_mode(const struct entry_list *l, struct file_entry *fe, int need_perms);
+unsigned char resolve_type(const struct entry_list *l, struct file_entry *fe);
+void stat_entry(const struct entry_list *l, struct file_entry *fe, struct stat_slot *slot);
+void prefetch_stats(struct entry_list *l);
+
+// sort.c
+uint64_t stat_sort_key(const struct stat_slot *slot);
+int sort_rec_init(struct arena *a, const struct entry_list *l, size_t i, struct sort_rec *rec);
+void sort_init(void);
+int sort_compare(const struct sort_rec *a, const struct sort_rec *b);
+int sort_entries(struct arena *a, struct entry_list *l);
+
+// Whether a listing in display has to stat every entry
+static inline int stat_needed(int display) {
+    return display >= DISPLAY_LONG || sort_key == SORT_TIME || sort_key == SORT_SIZE;
+}
+
+// layout.c
+size_t display_width(const char *name, size_t len);
+size_t terminal_width(void);
+size_t layout_max_cols(size_t count, size_t width);
+size_t layout_vertical(const struct entry_list *l, size_t extra, size_t width, uint16_t *col_width);
+size_t layout_horizontal(const struct entry_list *l, size_t extra, size_t width, uint16_t *col_width);
+
+// color.c
+void colors_init(void);
+mode_t color_prepare(const struct entry_list *l, struct file_entry *fe);
+void print_colored(const struct entry_list *l, struct file_entry *fe);
+
+// render.c
+void out_flush(void);
+void out_write(const char *s, size_t n);
+void out_str(const char *s);
+void out_char(char c);
+void list_long(const struct entry_list *l);
+void list_records(const char *dir, const struct entry_list *l, int display);
+void print_listing(const char *path, const struct entry_list *l, int display);
+
+// A string literal, without the strlen()
+#define out_lit(s) out_write(s, sizeof(s) - 1)
+
+// timefmt.c
+void time_format_init(void);
+size_t time_width(void);
+size_t format_time(struct time_cache *c, const struct timespec *ts, char *buf);
+
+// top.c
+int top_enter(const char *path);
+void top_leave(void);
+void top_offer(struct entry_list *one, int display);
+void top_print(int display);
+
+// walk.c
+size_t path_push(const char *name);
+int read_sorted(int fd, int display, int show_all, struct entry_list *l);
+void walk_tree(const char *path, int display, int recursive, int show_all, int unsorted);
+
+// parallel.c
+void list_directory_parallel(const char *path, int display, int nthreads, int recursive,
+                             int show_all);
+
+// cache.c
+int snap_enabled(void);
+char *snap_default_path(void);
+void snap_open(const char *path, uint64_t context);
+int snap_lookup(const struct stat *dir, unsigned int mask, struct entry_list *l);
+void snap_store(const struct stat *dir, unsigned int mask, const struct entry_list *l);
+void snap_save(void);
+void snap_print_stats(void);
+
+// watch.c
+void watch_directory(const char *path, int display);
+
+// stats.c
+extern __thread struct thread_stats *thread_stats;
+uint64_t stats_now(void);
+struct thread_stats *stats_register(void);
+int stats_switch(int phase);
+void stats_start(void);
+void print_stats(void);
+
+#define STATS_ON __builtin_expect(show_stats, 0)
+
+// This thread's counts, NULL if they could not be allocated
+static inline struct thread_stats *stats_self(void) {
+    return thread_stats ? thread_stats : stats_register();
+}
+
+static inline void stats_add(int counter, uint64_t n) {
+    if (STATS_ON) {
+        struct thread_stats *t = stats_self();
+        if (t)
+            t->counters[counter] += n;
+    }
+}
+
+static inline void stats_count(int counter) {
+    stats_add(counter, 1);
+}
+
+// A directory of count entries was read into an entry array
+static inline void stats_listed(size_t count) {
+    if (STATS_ON) {
+        struct thread_stats *t = stats_self();
+        if (t) {
+            t->counters[STATS_DIRS]++;
+            t->counters[STATS_ENTRIES] += count;
+            if (count > t->peak_entries)
+                t->peak_entries = count;
+        }
+    }
+}
+
+// Time from here on goes to phase; pass the result to stats_end() to go back
+static inline int stats_begin(int phase) {
+    return STATS_ON ? stats_switch(phase) : PHASE_IDLE;
+}
+
+static inline void stats_end(int prev) {
+    if (STATS_ON)
+        stats_switch(prev);
+}
+
+#endif
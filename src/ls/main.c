@@ -0,0 +1,265 @@
+#include "ls.h"
+
+int use_color = 0;
+int show_blocks = 0;                // -s: allocated sizes, summed over subdirectories
+int stat_threads = STAT_THREADS;
+int time_field = TIME_MTIME;
+unsigned int long_mask = STATX_LONG;    // fields -l fetches
+
+int main(int argc, char *argv[]) {
+    enum { OPT_STATS = 256, OPT_THREADS, OPT_MAX_FDS, OPT_TIME, OPT_COLOR, OPT_FORMAT, OPT_CACHE, OPT_WATCH,
+           OPT_TIME_STYLE, OPT_SORT, OPT_TOP };
+    static const struct option long_options[] = {
+        { "stats",   no_argument,       NULL, OPT_STATS },
+        { "threads", required_argument, NULL, OPT_THREADS },
+        { "max-fds", required_argument, NULL, OPT_MAX_FDS },
+        { "time",    required_argument, NULL, OPT_TIME },
+        { "time-style", required_argument, NULL, OPT_TIME_STYLE },
+        { "color",   optional_argument, NULL, OPT_COLOR },
+        { "format",  required_argument, NULL, OPT_FORMAT },
+        { "sort",    required_argument, NULL, OPT_SORT },
+        { "reverse", no_argument,       NULL, 'r' },
+        { "top",     required_argument, NULL, OPT_TOP },
+        { "cache",   optional_argument, NULL, OPT_CACHE },
+        { "watch",   no_argument,       NULL, OPT_WATCH },
+        { "total-size", no_argument,    NULL, 's' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    int display = DISPLAY_VERTICAL;
+    int threads_given = 0;
+    int max_fds_given = 0;
+    int color_when = -1;        // 1 always, 0 never, -1 on a terminal
+    int use_cache = 0;
+    int watch = 0;
+    char *cache_path = NULL;
+    int recursive = 0;
+    int unsorted = 0;
+    int show_all = 0;
+    int nthreads = 1;
+    const char *target_dir = ".";
+
+    while ((opt = getopt_long(argc, argv, "lxRUf0stSXvr", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'l': display = DISPLAY_LONG; break;
+            case 'x': display = DISPLAY_HORIZONTAL; break;
+            case 'R': recursive = 1; break;
+            case 'U': unsorted = 1; break;
+            case 'f': unsorted = 1; show_all = 1; break;
+            case '0': display = DISPLAY_NUL; break;
+            case 's': show_blocks = 1; break;
+            case 't': sort_key = SORT_TIME; unsorted = 0; break;
+            case 'S': sort_key = SORT_SIZE; unsorted = 0; break;
+            case 'X': sort_key = SORT_EXTENSION; unsorted = 0; break;
+            case 'v': sort_key = SORT_VERSION; unsorted = 0; break;
+            case 'r': sort_reverse = 1; break;
+            case OPT_STATS: show_stats = 1; stats_start(); break;
+            case OPT_THREADS:
+                nthreads = atoi(optarg);
+                if (nthreads < 1 || nthreads > MAX_THREADS) {
+                    fprintf(stderr, "%s: invalid thread count '%s'\n", argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                threads_given = 1;
+                break;
+            case OPT_MAX_FDS:
+                // The parent must stay open while a child is opened
+                max_dir_fds = atoi(optarg);
+                if (max_dir_fds < 2) {
+                    fprintf(stderr, "%s: invalid fd limit '%s'\n", argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                max_fds_given = 1;
+                break;
+            case OPT_COLOR:
+                if (!optarg || strcmp(optarg, "always") == 0 || strcmp(optarg, "yes") == 0 ||
+                    strcmp(optarg, "force") == 0) {
+                    color_when = 1;
+                } else if (strcmp(optarg, "never") == 0 || strcmp(optarg, "no") == 0 ||
+                           strcmp(optarg, "none") == 0) {
+                    color_when = 0;
+                } else if (strcmp(optarg, "auto") == 0 || strcmp(optarg, "tty") == 0 ||
+                           strcmp(optarg, "if-tty") == 0) {
+                    color_when = -1;
+                } else {
+                    fprintf(stderr, "%s: invalid color '%s'\n", argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_FORMAT:
+                if (strcmp(optarg, "long") == 0 || strcmp(optarg, "verbose") == 0) {
+                    display = DISPLAY_LONG;
+                } else if (strcmp(optarg, "across") == 0 || strcmp(optarg, "horizontal") == 0) {
+                    display = DISPLAY_HORIZONTAL;
+                } else if (strcmp(optarg, "vertical") == 0) {
+                    display = DISPLAY_VERTICAL;
+                } else if (strcmp(optarg, "ndjson") == 0) {
+                    display = DISPLAY_NDJSON;
+                } else {
+                    fprintf(stderr, "%s: invalid format '%s'\n", argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_SORT:
+                unsorted = 0;
+                if (strcmp(optarg, "name") == 0) {
+                    sort_key = SORT_NAME;
+                } else if (strcmp(optarg, "time") == 0) {
+                    sort_key = SORT_TIME;
+                } else if (strcmp(optarg, "size") == 0) {
+                    sort_key = SORT_SIZE;
+                } else if (strcmp(optarg, "extension") == 0) {
+                    sort_key = SORT_EXTENSION;
+                } else if (strcmp(optarg, "version") == 0) {
+                    sort_key = SORT_VERSION;
+                } else if (strcmp(optarg, "none") == 0) {
+                    unsorted = 1;
+                } else {
+                    fprintf(stderr, "%s: invalid sort '%s'\n", argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_TOP: {
+                char *end;
+                errno = 0;
+                unsigned long long n = strtoull(optarg, &end, 10);
+                if (errno || end == optarg || *end || optarg[0] == '-' || n == 0 ||
+                    n > SIZE_MAX / sizeof(struct stat_slot)) {
+                    fprintf(stderr, "%s: invalid top count '%s'\n", argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                top_count = n;
+                break;
+            }
+            case OPT_WATCH: watch = 1; break;
+            case OPT_CACHE:
+                use_cache = 1;
+                cache_path = optarg;
+                break;
+            case OPT_TIME:
+                if (strcmp(optarg, "mtime") == 0 || strcmp(optarg, "modification") == 0) {
+                    time_field = TIME_MTIME;
+                } else if (strcmp(optarg, "birth") == 0 || strcmp(optarg, "creation") == 0) {
+                    time_field = TIME_BIRTH;
+                } else {
+                    fprintf(stderr, "%s: invalid time '%s'\n", argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_TIME_STYLE:
+                if (strcmp(optarg, "full-iso") == 0) {
+                    time_style = TIME_STYLE_FULL_ISO;
+                } else if (strcmp(optarg, "long-iso") == 0) {
+                    time_style = TIME_STYLE_LONG_ISO;
+                } else if (strcmp(optarg, "iso") == 0) {
+                    time_style = TIME_STYLE_ISO;
+                } else if (strcmp(optarg, "locale") == 0) {
+                    time_style = TIME_STYLE_LOCALE;
+                } else {
+                    fprintf(stderr, "%s: invalid time style '%s'\n", argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-l] [-x] [-R] [-U] [-f] [-0] [-s] [-t] [-S] [-X] [-v] [-r] [--sort=WORD] [--top=N] [--format=WORD] [--threads=N] [--max-fds=N] [--time=mtime|birth] [--time-style=STYLE] [--color[=WHEN]] [--cache[=FILE]] [--watch] [--stats] [directory]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind < argc)
+        target_dir = argv[optind];
+    if (show_blocks && (watch || display >= DISPLAY_NDJSON || use_cache)) {
+        fprintf(stderr, "%s: -s needs the column or long format, without --watch or --cache\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (top_count && (unsorted || watch || show_blocks)) {
+        fprintf(stderr, "%s: --top lists in sort order, without -U, --watch or -s\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (watch && (recursive || unsorted || show_all || sort_key != SORT_NAME ||
+                  display >= DISPLAY_NDJSON)) {
+        fprintf(stderr, "%s: --watch lists one directory sorted by name, without -f, in the "
+                "column or long format\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Leave half of a low descriptor limit for everything else
+    struct rlimit rl;
+    if (!max_fds_given && getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+        rl.rlim_cur / 2 < (rlim_t)max_dir_fds)
+        max_dir_fds = rl.rlim_cur / 2 < 2 ? 2 : rl.rlim_cur / 2;
+
+    // Without -l, -t and -S fetch only what they sort on
+    if (display < DISPLAY_LONG && stat_needed(display))
+        long_mask = STATX_TYPE | STATX_MODE | (sort_key == SORT_SIZE ? STATX_SIZE : STATX_MTIME);
+    if (time_field == TIME_BIRTH)
+        long_mask |= STATX_BTIME;
+    if (show_blocks)
+        long_mask |= STATX_USAGE;
+
+    // --threads also sizes the -l stat prefetch pool
+    if (threads_given)
+        stat_threads = nthreads;
+
+    // Sort by the locale's collation order, via strxfrm() keys, unless it is
+    // plain byte order anyway
+    setlocale(LC_ALL, "");
+    const char *collate = setlocale(LC_COLLATE, NULL);
+    sort_collate = collate && strcmp(collate, "C") != 0 && strcmp(collate, "POSIX") != 0 &&
+                   strncmp(collate, "C.", 2) != 0;
+    time_format_init();
+    sort_init();
+
+    // Cached listings are sorted, and sized, for this locale and these sort
+    // options
+    char *default_cache = NULL;
+    if (use_cache && (cache_path || (cache_path = default_cache = snap_default_path()))) {
+        const char *ctype = setlocale(LC_CTYPE, NULL);
+        uint64_t context = sizeof(struct stat_slot) << 16 | sizeof(struct file_entry);
+        for (const char *c = sort_collate ? collate : "C"; *c; c++)
+            context = (context ^ (unsigned char)*c) * 0x100000001b3ULL;
+        context = (context ^ '/') * 0x100000001b3ULL;
+        for (const char *c = ctype ? ctype : "C"; *c; c++)
+            context = (context ^ (unsigned char)*c) * 0x100000001b3ULL;
+        int order = show_all << 8 | sort_key << 2 | sort_reverse << 1 |
+                    (sort_key == SORT_TIME && time_field == TIME_BIRTH);
+        context = (context ^ order) * 0x100000001b3ULL;
+        snap_open(cache_path, context);
+    }
+    // snap_open() made its own path, with the context appended
+    free(default_cache);
+
+    // By default colors are only for a terminal; piped output needs no lstat
+    // and no escape codes at all. Records never carry them.
+    out_interactive = isatty(STDOUT_FILENO);
+    use_color = color_when == -1 ? out_interactive : color_when;
+    if (display >= DISPLAY_NDJSON)
+        use_color = 0;
+    if (use_color)
+        colors_init();
+
+    // Headers print the path relative to the command-line directory
+    path_push(target_dir);
+    if (watch)
+        watch_directory(target_dir, display);
+    // -s sums whole subtrees, which only the parallel walker does; like the
+    // serial walk it holds at most max_dir_fds directories open
+    else if (show_blocks)
+        list_directory_parallel(target_dir, display, threads_given ? nthreads : STAT_THREADS,
+                                recursive, show_all);
+    else if (recursive && nthreads > 1 && !unsorted && !top_count)
+        list_directory_parallel(target_dir, display, nthreads, 1, show_all);
+    else
+        walk_tree(target_dir, display, recursive, show_all, unsorted || top_count);
+    // --top streams the tree as -U does and only prints at the end
+    if (top_count)
+        top_print(display);
+
+    if (snap_enabled())
+        snap_save();
+    if (show_stats)
+        print_stats();
+    out_flush();
+    return 0;
+}
@@ -0,0 +1,692 @@
+#include "ls.h"
+
+/*
+ * Disk usage (-s)
+ *
+ * With -s every directory's allocated size (st_blocks) is summed over its
+ * whole subtree, dotfiles included, by the parallel walker; below the
+ * listed directories tasks only count. A task adds up its own entries and
+ * every subdirectory adds its total to its parent's when it is complete,
+ * so a directory is complete with its last subdirectory. The printer waits
+ * for that instead of for the directory's own listing.
+ *
+ * A file with several hard links is counted once, as du does, at whichever
+ * link is summed first: in listing order within a directory, and across
+ * directories at the one read first. Every other link shows a size of 0,
+ * so the rows of a directory always add up to its total. Its (dev, ino)
+ * goes into a hash set split into shards with a lock each; only such files
+ * touch it. Workers keep their own counters,
+ * merged into usage_stats when the walk ends.
+ */
+#define LINK_SHARDS 64
+
+struct link_key {
+    uint64_t dev, ino;          // ino 0 marks an empty slot
+};
+
+static struct link_shard {
+    pthread_mutex_t lock;
+    struct link_key *keys;
+    size_t len, cap;
+} link_set[LINK_SHARDS];
+
+struct usage_counts usage_stats;
+
+// The top bits pick the shard, the low bits the slot
+static uint64_t link_hash(uint64_t dev, uint64_t ino) {
+    return (ino ^ dev << 40) * 0x9e3779b97f4a7c15ULL;
+}
+
+// Add (dev, ino) to the set of hard-linked files. Returns 1 if it was
+// already there.
+static int link_seen(uint64_t dev, uint64_t ino) {
+    uint64_t h = link_hash(dev, ino);
+    struct link_shard *shard = &link_set[h >> 58];
+    if (ino == 0)
+        return 0;
+
+    pthread_mutex_lock(&shard->lock);
+    if ((shard->len + 1) * 2 > shard->cap) {
+        size_t cap = shard->cap ? shard->cap * 2 : 64;
+        struct link_key *keys = calloc(cap, sizeof(struct link_key));
+        stats_count(STATS_MALLOCS);
+        if (!keys) {
+            // Counted twice rather than not at all
+            pthread_mutex_unlock(&shard->lock);
+            return 0;
+        }
+        for (size_t i = 0; i < shard->cap; i++) {
+            if (!shard->keys[i].ino)
+                continue;
+            size_t j = link_hash(shard->keys[i].dev, shard->keys[i].ino) & (cap - 1);
+            while (keys[j].ino)
+                j = (j + 1) & (cap - 1);
+            keys[j] = shard->keys[i];
+        }
+        free(shard->keys);
+        shard->keys = keys;
+        shard->cap = cap;
+    }
+
+    size_t i = h & (shard->cap - 1);
+    for (; shard->keys[i].ino; i = (i + 1) & (shard->cap - 1)) {
+        if (shard->keys[i].ino == ino && shard->keys[i].dev == dev) {
+            pthread_mutex_unlock(&shard->lock);
+            return 1;
+        }
+    }
+    shard->keys[i].dev = dev;
+    shard->keys[i].ino = ino;
+    shard->len++;
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+// Blocks an entry adds to its directory's total. A hard link counted
+// already gets 0 blocks in its slot too.
+static blkcnt_t usage_add(struct usage_counts *c, struct stat_slot *slot) {
+    if (slot->err)
+        return 0;
+    c->entries++;
+    if (!S_ISDIR(slot->st.st_mode) && slot->st.st_nlink > 1 &&
+        link_seen(slot->st.st_dev, slot->st.st_ino)) {
+        c->links++;
+        slot->st.st_blocks = 0;
+        return 0;
+    }
+    return slot->st.st_blocks;
+}
+
+/*
+ * Parallel -R (--threads=N)
+ *
+ * Every directory becomes a dir_task. Workers own a deque each: they push
+ * the subdirectories they discover at the bottom and pop from the bottom
+ * (depth-first, which is also the order the printer wants), and idle
+ * workers steal from the top of other deques. A worker reads, sorts and
+ * stats its directory into one malloc'd block attached to the task.
+ *
+ * A task opens its directory with openat() on its parent's fd, which stays
+ * open until the last child has done so. The printer frees a task only
+ * after all its children, so the parent is always still there. At most
+ * max_dir_fds directories are open at once: each worker may be reading
+ * one, and a directory is kept open for its children only while the rest
+ * are under the cap. Otherwise it is closed before they are queued and
+ * they open their full path instead.
+ *
+ * The main thread is the reorder stage: it walks the task tree depth-first
+ * in sorted order, waiting on each task until it is done, so the output is
+ * byte-for-byte the same as the serial path. Workers stop taking tasks
+ * while MAX_UNPRINTED read directories wait for it, which bounds memory
+ * when the printer falls behind. If the task it waits for is still queued
+ * then, it takes that out of its deque and hands it to the next worker.
+ * With -s the bound is off: a directory is printed only once its whole
+ * subtree is read.
+ */
+struct dir_task {
+    char *path;                 // full path, for the header line
+    const char *name;           // last component of path
+    struct dir_task *parent;    // opened relative to parent->fd
+    int deque;                  // queued on pool->deques[deque]
+    int fd;
+    int fd_refs;                // this task plus children not yet opened
+    char *block;                // stat slots (for -l), entries, then names
+    struct entry_list list;     // points into block, dirfd -1
+    int err;                    // errno from reading the directory, 0 if fine
+    struct dir_task **children; // listed subdirectories, in sorted order
+    size_t nchildren;
+    int done;
+    // -s
+    int quiet;                  // only summed, never listed; frees itself
+    int sized;                  // blocks covers the whole subtree
+    int size_refs;              // this task plus children not yet sized
+    blkcnt_t blocks;            // everything under the directory
+    blkcnt_t *entry_blocks;     // the parent's slot for this directory, if listed
+};
+
+struct task_deque {
+    pthread_mutex_t lock;
+    struct dir_task **items;    // live tasks are items[head..tail)
+    size_t head, tail, cap;
+};
+
+struct walk_pool {
+    struct task_deque *deques;
+    int nthreads;
+    int recursive;              // list subdirectories, not only sum them (-s)
+    int show_all;               // list dotfiles, "." and ".." (-f)
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;     // signalled when a task is queued or the walk ends
+    pthread_cond_t done_cv;     // signalled when a task finishes
+    size_t queued;              // tasks sitting in deques
+    int open_fds;               // directories open, at most max_dir_fds
+    size_t pending;             // tasks queued or being processed
+    size_t unprinted;           // listed tasks done and not printed yet
+    size_t max_unprinted;
+    struct dir_task *urgent;    // taken out of its deque for the printer
+    size_t arena_peak;
+    size_t reserved;
+    size_t chunk_mallocs;
+};
+
+struct walk_worker {
+    struct walk_pool *pool;
+    int id;
+    int display;
+    struct usage_counts counts;
+};
+
+static int deque_push(struct task_deque *d, struct dir_task *t) {
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->cap) {
+        if (d->head > 0) {
+            memmove(d->items, d->items + d->head, (d->tail - d->head) * sizeof(*d->items));
+            d->tail -= d->head;
+            d->head = 0;
+        } else {
+            size_t new_cap = d->cap ? d->cap * 2 : 64;
+            struct dir_task **items = realloc(d->items, new_cap * sizeof(*items));
+            stats_count(STATS_MALLOCS);
+            if (!items) {
+                pthread_mutex_unlock(&d->lock);
+                return -1;
+            }
+            d->items = items;
+            d->cap = new_cap;
+        }
+    }
+    d->items[d->tail++] = t;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+static struct dir_task *deque_pop(struct task_deque *d) {
+    struct dir_task *t = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head)
+        t = d->items[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+static struct dir_task *deque_steal(struct task_deque *d) {
+    struct dir_task *t = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head)
+        t = d->items[d->head++];
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+// Take t out of d. Returns 0, or -1 if a worker has popped it already.
+static int deque_remove(struct task_deque *d, struct dir_task *t) {
+    int ret = -1;
+    pthread_mutex_lock(&d->lock);
+    for (size_t i = d->tail; i-- > d->head; ) {
+        if (d->items[i] == t) {
+            memmove(d->items + i, d->items + i + 1, (d->tail - i - 1) * sizeof(*d->items));
+            d->tail--;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ret;
+}
+
+// New task for parent/name, or for the command-line path name if parent is NULL.
+static struct dir_task *task_new(struct dir_task *parent, const char *name) {
+    struct dir_task *t = calloc(1, sizeof(struct dir_task));
+    if (!t)
+        return NULL;
+
+    size_t plen = parent ? strlen(parent->path) + 1 : 0, nlen = strlen(name);
+    t->path = malloc(plen + nlen + 1);
+    stats_add(STATS_MALLOCS, 2);
+    if (!t->path) {
+        free(t);
+        return NULL;
+    }
+    if (parent) {
+        memcpy(t->path, parent->path, plen - 1);
+        t->path[plen - 1] = '/';
+    }
+    memcpy(t->path + plen, name, nlen + 1);
+    t->name = t->path + plen;
+    t->parent = parent;
+    t->fd = -1;
+    t->size_refs = 1;
+    return t;
+}
+
+static void task_close_fd(struct walk_pool *pool, struct dir_task *t) {
+    close_directory(t->fd);
+    t->fd = -1;
+    __atomic_sub_fetch(&pool->open_fds, 1, __ATOMIC_RELAXED);
+}
+
+static void task_release_fd(struct walk_pool *pool, struct dir_task *t) {
+    if (__atomic_sub_fetch(&t->fd_refs, 1, __ATOMIC_ACQ_REL) == 0 && t->fd != -1)
+        task_close_fd(pool, t);
+}
+
+// Drop one of t's -s references. The last one completes t: its total goes
+// to its parent's, possibly completing the parent in turn.
+static void size_release(struct walk_pool *pool, struct dir_task *t) {
+    while (t && __atomic_sub_fetch(&t->size_refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        struct dir_task *parent = t->parent;
+        blkcnt_t blocks = __atomic_load_n(&t->blocks, __ATOMIC_RELAXED);
+        if (t->entry_blocks)
+            __atomic_add_fetch(t->entry_blocks, blocks, __ATOMIC_RELAXED);
+        if (parent)
+            __atomic_add_fetch(&parent->blocks, blocks, __ATOMIC_RELAXED);
+
+        if (t->quiet) {
+            free(t->block);
+            free(t->children);
+            free(t->path);
+            free(t);
+        } else {
+            pthread_mutex_lock(&pool->lock);
+            t->sized = 1;
+            pthread_cond_broadcast(&pool->done_cv);
+            pthread_mutex_unlock(&pool->lock);
+        }
+        t = parent;
+    }
+}
+
+static void pool_submit(struct walk_pool *pool, int id, struct dir_task *t) {
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+
+    t->deque = id;
+    if (deque_push(&pool->deques[id], t) == -1) {
+        // Cannot queue it: report the failure through the printer instead
+        t->err = ENOMEM;
+        if (t->parent)
+            task_release_fd(pool, t->parent);
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        t->done = 1;
+        if (!t->quiet)
+            pool->unprinted++;
+        pthread_cond_broadcast(&pool->done_cv);
+        pthread_mutex_unlock(&pool->lock);
+        if (show_blocks)
+            size_release(pool, t);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int dot_or_dotdot(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// The worker's read_sorted(): returns 0 or an errno value
+static int read_task_sorted(struct arena *a, int fd, int display, int show_all,
+                            struct entry_list *l) {
+    struct dir_buffer db;
+
+    if (read_directory(a, fd, &db) == -1)
+        return errno;
+    if (stat_needed(display) || use_color || show_blocks)
+        stat_dir_begin(fd);
+
+    if (collect_entries(a, &db, show_all, l) == -1)
+        return ENOMEM;
+    l->dirfd = fd;
+
+    // Stat here, off the printing thread. Workers already run in parallel
+    // across directories, so the stats of one directory are issued serially.
+    if (stat_needed(display) || show_blocks) {
+        l->slots = arena_alloc(a, (l->count ? l->count : 1) * sizeof(struct stat_slot));
+        if (!l->slots)
+            return ENOMEM;
+        for (size_t i = 0; i < l->count; i++) {
+            l->ents[i].stat_idx = i;
+            stat_entry(l, &l->ents[i], &l->slots[i]);
+        }
+    }
+
+    if (sort_entries(a, l) == -1)
+        return ENOMEM;
+    return 0;
+}
+
+// Read, sort and stat the open directory of t, then queue its subdirectories.
+static void read_task(struct walk_worker *w, struct arena *a, struct dir_task *t) {
+    struct walk_pool *pool = w->pool;
+    int display = w->display;
+    struct arena_mark mark = arena_get_mark(a);
+    struct entry_list l;
+    struct stat dir_st;
+    unsigned int mask = display >= DISPLAY_LONG ? long_mask : 0;
+    int cacheable = snap_enabled() && stat_directory(t->fd, &dir_st) == 0;
+
+    if (cacheable && snap_lookup(&dir_st, mask, &l) == 0) {
+        l.dirfd = t->fd;
+        if (use_color)
+            stat_dir_begin(t->fd);
+    } else if ((t->err = read_task_sorted(a, t->fd, display, pool->show_all, &l)) != 0) {
+        arena_release(a, mark);
+        return;
+    } else if (cacheable) {
+        snap_store(&dir_st, mask, &l);
+    }
+
+    // Resolve types (and modes when coloring) for the rest. With -s the
+    // dotfiles are there only to be summed, unless -f lists them, as is all
+    // of a quiet task. "." and ".." are neither summed nor walked.
+    size_t names_len = 0, nsub = 0, shown = 0;
+    for (size_t i = 0; i < l.count; i++) {
+        struct file_entry *fe = &l.ents[i];
+        const char *name = entry_name(&l, fe);
+        int listed = !t->quiet && (pool->show_all || name[0] != '.');
+        if (listed && use_color && !color_prepare(&l, fe))
+            perror("lstat failed");
+        if (!dot_or_dotdot(name)) {
+            if (resolve_type(&l, fe) == DT_DIR)
+                nsub++;
+            if (show_blocks)
+                t->blocks += usage_add(&w->counts, &l.slots[fe->stat_idx]);
+        }
+        if (listed) {
+            names_len += fe->name_len + 1;
+            shown++;
+        }
+    }
+
+    // Move the listed entries out of the worker's arena into a block owned
+    // by the task, packing the names. Stats made only to sort by are left.
+    int keep_slots = l.slots && shown && (display >= DISPLAY_LONG || show_blocks);
+    size_t slots_size = keep_slots ? l.count * sizeof(struct stat_slot) : 0;
+    t->block = shown ? malloc(slots_size + shown * sizeof(struct file_entry) + names_len + 1) : NULL;
+    t->children = nsub ? malloc(nsub * sizeof(struct dir_task *)) : NULL;
+    stats_add(STATS_MALLOCS, !!shown + !!nsub);
+    if ((shown && !t->block) || (nsub && !t->children)) {
+        free(t->block);
+        free(t->children);
+        t->block = NULL;
+        t->children = NULL;
+        t->err = ENOMEM;
+        arena_release(a, mark);
+        return;
+    }
+
+    t->list = l;
+    t->list.count = shown;
+    t->list.dirfd = -1;
+    t->list.slots = slots_size ? memcpy(t->block, l.slots, slots_size) : NULL;
+    t->list.ents = (struct file_entry *)(t->block + slots_size);
+    char *names = t->block + slots_size + shown * sizeof(struct file_entry);
+    t->list.names = names;
+
+    // Listed subdirectories go at the front of children, in order, and the
+    // quiet ones from the back: the printer must not see those, as they
+    // free themselves
+    size_t names_pos = 0, nquiet = 0;
+    for (size_t i = 0, j = 0; i < l.count; i++) {
+        const struct file_entry *src = &l.ents[i];
+        const char *name = entry_name(&l, src);
+        struct file_entry *fe = NULL;
+        if (!t->quiet && (pool->show_all || name[0] != '.')) {
+            fe = &t->list.ents[j++];
+            *fe = *src;
+            fe->name_off = names_pos;
+            memcpy(names + names_pos, name, fe->name_len + 1);
+            names_pos += fe->name_len + 1;
+            name = names + fe->name_off;
+        }
+
+        if (src->type == DT_DIR && !dot_or_dotdot(name)) {
+            struct dir_task *child = task_new(t, name);
+            if (!child)
+                continue;
+            child->quiet = !fe || !pool->recursive;
+            if (fe && show_blocks)
+                child->entry_blocks = &t->list.slots[fe->stat_idx].st.st_blocks;
+            if (child->quiet)
+                t->children[nsub - ++nquiet] = child;
+            else
+                t->children[t->nchildren++] = child;
+        }
+    }
+    arena_release(a, mark);
+
+    // Keep the directory open for the children only while that leaves a
+    // descriptor for every worker. The count includes the fds the workers
+    // hold now, so the directories kept never go over the cap minus those.
+    size_t nlisted = t->nchildren;
+    if (nlisted + nquiet &&
+        __atomic_load_n(&pool->open_fds, __ATOMIC_RELAXED) > max_dir_fds - pool->nthreads) {
+        task_close_fd(pool, t);
+        __atomic_add_fetch(&walk_stats.reopens, nlisted + nquiet, __ATOMIC_RELAXED);
+    }
+
+    // Push in reverse so the first subdirectory is popped (and printed) first
+    __atomic_add_fetch(&t->fd_refs, nlisted + nquiet, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&t->size_refs, nlisted + nquiet, __ATOMIC_ACQ_REL);
+    for (size_t i = nquiet; i-- > 0; )
+        pool_submit(pool, w->id, t->children[nsub - 1 - i]);
+    for (size_t i = nlisted; i-- > 0; )
+        pool_submit(pool, w->id, t->children[i]);
+}
+
+static void process_task(struct walk_worker *w, struct arena *a, struct dir_task *t) {
+    // A parent closed to stay under the cap did so before queueing t
+    if (t->parent && t->parent->fd != -1)
+        t->fd = open_directory(t->parent->fd, t->name);
+    else
+        t->fd = open_directory(AT_FDCWD, t->path);
+    int open_errno = errno;
+    if (t->parent)
+        task_release_fd(w->pool, t->parent);
+    if (t->fd == -1) {
+        t->err = open_errno;
+        return;
+    }
+    __atomic_add_fetch(&w->pool->open_fds, 1, __ATOMIC_RELAXED);
+
+    // Children take their references before they are queued
+    t->fd_refs = 1;
+    read_task(w, a, t);
+    task_release_fd(w->pool, t);
+}
+
+static void *walk_worker_main(void *arg) {
+    struct walk_worker *w = arg;
+    struct walk_pool *pool = w->pool;
+    struct arena a = { 0 };
+
+    for (;;) {
+        // Far enough ahead of the printer: wait until it catches up or
+        // needs a task no worker has taken
+        pthread_mutex_lock(&pool->lock);
+        while (pool->unprinted >= pool->max_unprinted && !pool->urgent && pool->pending)
+            pthread_cond_wait(&pool->work_cv, &pool->lock);
+        struct dir_task *t = pool->urgent;
+        pool->urgent = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (!t) {
+            t = deque_pop(&pool->deques[w->id]);
+            for (int i = 1; !t && i < pool->nthreads; i++)
+                t = deque_steal(&pool->deques[(w->id + i) % pool->nthreads]);
+
+            pthread_mutex_lock(&pool->lock);
+            if (!t) {
+                if (pool->pending == 0) {
+                    pthread_mutex_unlock(&pool->lock);
+                    break;
+                }
+                if (pool->queued == 0 && !pool->urgent)
+                    pthread_cond_wait(&pool->work_cv, &pool->lock);
+                pthread_mutex_unlock(&pool->lock);
+                continue;
+            }
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        process_task(w, &a, t);
+
+        pthread_mutex_lock(&pool->lock);
+        t->done = 1;
+        if (!t->quiet)
+            pool->unprinted++;
+        if (--pool->pending == 0)
+            pthread_cond_broadcast(&pool->work_cv);
+        pthread_cond_broadcast(&pool->done_cv);
+        pthread_mutex_unlock(&pool->lock);
+        if (show_blocks)
+            size_release(pool, t);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (a.peak > pool->arena_peak)
+        pool->arena_peak = a.peak;
+    pool->reserved += a.reserved;
+    pool->chunk_mallocs += a.chunk_mallocs;
+    pthread_mutex_unlock(&pool->lock);
+
+    while (a.head) {
+        struct arena_chunk *c = a.head;
+        a.head = c->prev;
+        free(c);
+    }
+    while (a.free_list) {
+        struct arena_chunk *c = a.free_list;
+        a.free_list = c->prev;
+        free(c);
+    }
+    return NULL;
+}
+
+// Reorder stage: print tasks depth-first in sorted order as they complete.
+static void print_task(struct walk_pool *pool, struct dir_task *t, int display) {
+    // With -s a directory's size is known only once its subtree is done
+    int asked = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (!(show_blocks ? t->sized : t->done)) {
+        if (!asked && pool->unprinted >= pool->max_unprinted) {
+            // The workers are waiting. Unless one of them has t already,
+            // take it out of its deque and hand it to the next one.
+            asked = 1;
+            pthread_mutex_unlock(&pool->lock);
+            int taken = deque_remove(&pool->deques[t->deque], t) == 0;
+            pthread_mutex_lock(&pool->lock);
+            if (taken) {
+                pool->queued--;
+                pool->urgent = t;
+                pthread_cond_broadcast(&pool->work_cv);
+            }
+            continue;
+        }
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (t->err) {
+        errno = t->err;
+        perror("opendir failed");
+    } else {
+        // Modes were resolved by the worker; the fd may be closed by now
+        t->list.blocks = t->blocks;
+        print_listing(t->path, &t->list, display);
+    }
+    free(t->block);
+    free(t->path);
+    pthread_mutex_lock(&pool->lock);
+    if (pool->unprinted-- == pool->max_unprinted)
+        pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < t->nchildren; i++)
+        print_task(pool, t->children[i], display);
+
+    free(t->children);
+    free(t);
+}
+
+// List path and, with recursive, everything below it, with the dotfiles if
+// show_all is set. Without recursive the subdirectories are only read for
+// their -s sizes.
+void list_directory_parallel(const char *path, int display, int nthreads, int recursive,
+                             int show_all) {
+    struct walk_pool pool = { 0 };
+    // Every worker needs a descriptor of its own
+    if (nthreads > max_dir_fds)
+        nthreads = max_dir_fds;
+    pool.nthreads = nthreads;
+    pool.recursive = recursive;
+    pool.show_all = show_all;
+    pool.max_unprinted = show_blocks ? SIZE_MAX : MAX_UNPRINTED;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work_cv, NULL);
+    pthread_cond_init(&pool.done_cv, NULL);
+
+    pool.deques = calloc(nthreads, sizeof(struct task_deque));
+    struct walk_worker *workers = calloc(nthreads, sizeof(struct walk_worker));
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    stats_add(STATS_MALLOCS, 3);
+    struct dir_task *root = task_new(NULL, path);
+    if (!pool.deques || !workers || !threads || !root) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < nthreads; i++)
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+    for (int i = 0; i < LINK_SHARDS; i++)
+        pthread_mutex_init(&link_set[i].lock, NULL);
+    pool_submit(&pool, 0, root);
+
+    int started = 0;
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        workers[i].display = display;
+        if (pthread_create(&threads[i], NULL, walk_worker_main, &workers[i]) != 0)
+            break;
+        started++;
+    }
+    if (started == 0) {
+        perror("pthread_create failed");
+        exit(EXIT_FAILURE);
+    }
+    print_task(&pool, root, display);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    if (pool.arena_peak > arena.peak)
+        arena.peak = pool.arena_peak;
+    arena.reserved += pool.reserved;
+    arena.chunk_mallocs += pool.chunk_mallocs;
+    for (int i = 0; i < started; i++) {
+        usage_stats.entries += workers[i].counts.entries;
+        usage_stats.links += workers[i].counts.links;
+    }
+    for (int i = 0; i < LINK_SHARDS; i++) {
+        pthread_mutex_destroy(&link_set[i].lock);
+        free(link_set[i].keys);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].items);
+    }
+    free(pool.deques);
+    free(workers);
+    free(threads);
+    pthread_cond_destroy(&pool.done_cv);
+    pthread_cond_destroy(&pool.work_cv);
+    pthread_mutex_destroy(&pool.lock);
+}
@@ -0,0 +1,523 @@
+#include "ls.h"
+
+/*
+ * Output builder
+ *
+ * All listing output is formatted into one large buffer with hand-rolled
+ * padding and number formatting, then handed to the kernel with write().
+ * A name too large for the buffer goes out with the buffered bytes in a
+ * single writev() instead of being copied.
+ */
+static char outbuf[OUTBUF_SIZE];
+static size_t outlen = 0;
+int out_interactive = 0;          // flush after every directory on a terminal
+
+static void out_writev(struct iovec *iov, int iovcnt) {
+    int phase = stats_begin(PHASE_WRITE);
+    while (iovcnt > 0) {
+        ssize_t n = writev(STDOUT_FILENO, iov, iovcnt);
+        stats_count(STATS_WRITE);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("write failed");
+            exit(EXIT_FAILURE);
+        }
+        stats_add(STATS_BYTES, n);
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    stats_end(phase);
+}
+
+void out_flush(void) {
+    if (outlen == 0)
+        return;
+    struct iovec iov = { outbuf, outlen };
+    out_writev(&iov, 1);
+    outlen = 0;
+}
+
+void out_write(const char *s, size_t n) {
+    if (outlen + n <= OUTBUF_SIZE) {
+        memcpy(outbuf + outlen, s, n);
+        outlen += n;
+        return;
+    }
+    if (n < OUTBUF_SIZE / 2) {
+        out_flush();
+        memcpy(outbuf, s, n);
+        outlen = n;
+        return;
+    }
+
+    struct iovec iov[2] = { { outbuf, outlen }, { (char *)s, n } };
+    out_writev(iov, 2);
+    outlen = 0;
+}
+
+void out_str(const char *s) {
+    out_write(s, strlen(s));
+}
+
+void out_char(char c) {
+    if (outlen == OUTBUF_SIZE)
+        out_flush();
+    outbuf[outlen++] = c;
+}
+
+static void out_spaces(size_t n) {
+    while (n > 0) {
+        if (outlen == OUTBUF_SIZE)
+            out_flush();
+        size_t chunk = OUTBUF_SIZE - outlen < n ? OUTBUF_SIZE - outlen : n;
+        memset(outbuf + outlen, ' ', chunk);
+        outlen += chunk;
+        n -= chunk;
+    }
+}
+
+// Write v right-aligned in a field of at least width characters.
+static void out_num(long long v, int width) {
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    unsigned long long u = v < 0 ? -(unsigned long long)v : (unsigned long long)v;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        *--p = '-';
+
+    int len = tmp + sizeof(tmp) - p;
+    if (len < width)
+        out_spaces(width - len);
+    out_write(p, len);
+}
+
+// The ten-character mode string of list_long, without a terminator
+static void format_permissions(mode_t mode, char *perms) {
+    memset(perms, '-', 10);
+    if (S_ISDIR(mode)) perms[0] = 'd';
+    else if (S_ISLNK(mode)) perms[0] = 'l';
+    else if (S_ISCHR(mode)) perms[0] = 'c';
+    else if (S_ISBLK(mode)) perms[0] = 'b';
+    else if (S_ISSOCK(mode)) perms[0] = 's';
+    else if (S_ISFIFO(mode)) perms[0] = 'p';
+
+    if (mode & S_IRUSR) perms[1] = 'r';
+    if (mode & S_IWUSR) perms[2] = 'w';
+    if (mode & S_IXUSR) perms[3] = 'x';
+    if (mode & S_IRGRP) perms[4] = 'r';
+    if (mode & S_IWGRP) perms[5] = 'w';
+    if (mode & S_IXGRP) perms[6] = 'x';
+    if (mode & S_IROTH) perms[7] = 'r';
+    if (mode & S_IWOTH) perms[8] = 'w';
+    if (mode & S_IXOTH) perms[9] = 'x';
+}
+
+static void print_permissions(mode_t mode) {
+    char perms[11];
+    format_permissions(mode, perms);
+    perms[10] = ' ';
+    out_write(perms, 11);
+}
+
+/*
+ * uid/gid -> name cache
+ *
+ * getpwuid()/getgrgid() may go through NSS to sssd or LDAP, while a
+ * directory usually has only a handful of owners. Each table is open
+ * addressed with linear probing and doubles when half full. Only the
+ * printing thread formats long listings, so no locking is needed.
+ */
+struct name_cache user_cache, group_cache;
+static struct time_cache time_cache;    // list_long's, on the printing thread
+
+static size_t name_cache_hash(unsigned int id, size_t cap) {
+    return (size_t)((id * 2654435761u) & (cap - 1));
+}
+
+static struct name_cache_slot *name_cache_find(struct name_cache *c, unsigned int id) {
+    size_t i = name_cache_hash(id, c->cap);
+    while (c->slots[i].used && c->slots[i].id != id)
+        i = (i + 1) & (c->cap - 1);
+    return &c->slots[i];
+}
+
+static int name_cache_grow(struct name_cache *c) {
+    size_t old_cap = c->cap;
+    struct name_cache_slot *old = c->slots;
+
+    c->cap = old_cap ? old_cap * 2 : NAME_CACHE_SIZE;
+    c->slots = calloc(c->cap, sizeof(struct name_cache_slot));
+    stats_count(STATS_MALLOCS);
+    if (!c->slots) {
+        c->slots = old;
+        c->cap = old_cap;
+        return -1;
+    }
+
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].used)
+            *name_cache_find(c, old[i].id) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static const char *cached_name(struct name_cache *c, unsigned int id, int is_group) {
+    if (c->slots) {
+        struct name_cache_slot *slot = name_cache_find(c, id);
+        if (slot->used) {
+            c->hits++;
+            return slot->name ? slot->name : "?";
+        }
+    }
+
+    c->misses++;
+    const char *name = NULL;
+    if (is_group) {
+        struct group *gr = getgrgid(id);
+        if (gr) name = gr->gr_name;
+    } else {
+        struct passwd *pw = getpwuid(id);
+        if (pw) name = pw->pw_name;
+    }
+
+    if ((c->len + 1) * 2 > c->cap && name_cache_grow(c) == -1)
+        return name ? name : "?";
+
+    struct name_cache_slot *slot = name_cache_find(c, id);
+    slot->used = 1;
+    slot->id = id;
+    slot->name = name ? strdup(name) : NULL;
+    stats_add(STATS_MALLOCS, name != NULL);
+    c->len++;
+    return slot->name ? slot->name : "?";
+}
+
+// -s sizes are shown in KiB, as GNU ls does by default
+static long long blocks_kib(blkcnt_t blocks) {
+    return (blocks + 1) / 2;
+}
+
+// Width of the widest -s size in l
+static int blocks_width(const struct entry_list *l) {
+    long long max = 0;
+    for (size_t i = 0; i < l->count; i++) {
+        const struct stat_slot *slot = &l->slots[l->ents[i].stat_idx];
+        if (!slot->err && blocks_kib(slot->st.st_blocks) > max)
+            max = blocks_kib(slot->st.st_blocks);
+    }
+    int width = 1;
+    for (; max >= 10; max /= 10)
+        width++;
+    return width;
+}
+
+void list_long(const struct entry_list *l) {
+    int size_width = show_blocks ? blocks_width(l) : 0;
+    for (size_t i = 0; i < l->count; i++) {
+        struct file_entry *fe = &l->ents[i];
+        struct stat_slot *slot = &l->slots[fe->stat_idx];
+        struct stat *st = &slot->st;
+        if (slot->err) {
+            errno = slot->err;
+            perror("stat failed");
+            continue;
+        }
+
+        if (size_width) {
+            out_num(blocks_kib(st->st_blocks), size_width);
+            out_char(' ');
+        }
+        print_permissions(st->st_mode);
+        out_num(st->st_nlink, 2);
+        out_char(' ');
+
+        out_str(cached_name(&user_cache, st->st_uid, 0));
+        out_char(' ');
+        out_str(cached_name(&group_cache, st->st_gid, 1));
+        out_char(' ');
+
+        out_num(st->st_size, 6);
+        out_char(' ');
+
+        const struct timespec *when = &st->st_mtim;
+        if (time_field == TIME_BIRTH)
+            when = slot->btime.tv_nsec == -1 ? NULL : &slot->btime;
+        char time_text[TIME_TEXT_MAX];
+        size_t time_len = when ? format_time(&time_cache, when, time_text) : 0;
+        if (time_len) {
+            out_write(time_text, time_len);
+        } else {
+            out_spaces(time_width() - 1);
+            out_char('?');
+        }
+        out_char(' ');
+
+        print_colored(l, fe);
+        out_char('\n');
+    }
+}
+
+/*
+ * Machine-readable records (--format=ndjson, -0)
+ *
+ * One record per entry with the fields of list_long: the mode string, link
+ * count, owner, group, size and the listed time in seconds since the epoch,
+ * then the directory (as the -R headers print it) and the name. Everything
+ * is encoded by hand into the output buffer. --format=ndjson writes a JSON
+ * object per line; -0 ends every field with a NUL, so a record is always
+ * eight fields and names need no quoting at all.
+ *
+ * JSON strings must be UTF-8 but names are arbitrary bytes, so a byte that
+ * is not part of a valid sequence is written as \udcXX (the surrogateescape
+ * convention) and the original name can still be recovered.
+ */
+
+// Length of the valid UTF-8 sequence at s, or 0 if s[0] does not start one
+static size_t utf8_seq_len(const unsigned char *s, size_t len) {
+    unsigned char c = s[0], lo = 0x80, hi = 0xbf;
+    size_t n;
+    if (c >= 0xc2 && c <= 0xdf) n = 2;
+    else if (c >= 0xe0 && c <= 0xef) n = 3;
+    else if (c >= 0xf0 && c <= 0xf4) n = 4;
+    else return 0;
+
+    // Reject overlong forms, surrogates and code points past U+10FFFF
+    if (c == 0xe0) lo = 0xa0;
+    else if (c == 0xed) hi = 0x9f;
+    else if (c == 0xf0) lo = 0x90;
+    else if (c == 0xf4) hi = 0x8f;
+
+    if (len < n || s[1] < lo || s[1] > hi)
+        return 0;
+    for (size_t i = 2; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            return 0;
+    }
+    return n;
+}
+
+// Nonzero if any of the eight bytes at s is a control character, a quote,
+// a backslash or not ASCII
+static int json_special8(const unsigned char *s) {
+    const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+    uint64_t word, quote, bslash;
+    memcpy(&word, s, 8);
+    quote = word ^ (ones * '"');
+    bslash = word ^ (ones * '\\');
+    return (((((word - ones * 0x20) | (quote - ones) | (bslash - ones)) & ~word) | word) &
+            highs) != 0;
+}
+
+// Write len bytes of s as a quoted JSON string. Runs of plain ASCII are
+// found eight bytes at a time and copied in one piece.
+static void out_json_str(const char *str, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *s = (const unsigned char *)str, *end = s + len, *run = s;
+
+    out_char('"');
+    while (s < end) {
+        while (end - s >= 8 && !json_special8(s))
+            s += 8;
+        if (s == end)
+            break;
+
+        unsigned char c = *s;
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            s++;
+            continue;
+        }
+        if (c >= 0x80) {
+            size_t n = utf8_seq_len(s, end - s);
+            if (n) {
+                s += n;
+                continue;
+            }
+        }
+
+        out_write((const char *)run, s - run);
+        char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+        if (c == '"' || c == '\\') {
+            esc[1] = c;
+            out_write(esc, 2);
+        } else if (c == '\n') {
+            out_lit("\\n");
+        } else if (c == '\t') {
+            out_lit("\\t");
+        } else {
+            if (c >= 0x80) {
+                esc[2] = 'd';
+                esc[3] = 'c';
+            }
+            out_write(esc, 6);
+        }
+        run = ++s;
+    }
+    out_write((const char *)run, s - run);
+    out_char('"');
+}
+
+void list_records(const char *dir, const struct entry_list *l, int display) {
+    size_t dir_len = strlen(dir);
+    for (size_t i = 0; i < l->count; i++) {
+        struct file_entry *fe = &l->ents[i];
+        struct stat_slot *slot = &l->slots[fe->stat_idx];
+        struct stat *st = &slot->st;
+        if (slot->err) {
+            errno = slot->err;
+            perror("stat failed");
+            continue;
+        }
+
+        char perms[10];
+        format_permissions(st->st_mode, perms);
+        const char *owner = cached_name(&user_cache, st->st_uid, 0);
+        const char *group = cached_name(&group_cache, st->st_gid, 1);
+        const time_t *when = &st->st_mtime;
+        if (time_field == TIME_BIRTH)
+            when = slot->btime.tv_nsec == -1 ? NULL : &slot->btime.tv_sec;
+
+        if (display == DISPLAY_NUL) {
+            // An unknown birth time is an empty field
+            out_write(perms, 10);
+            out_char('\0');
+            out_num(st->st_nlink, 0);
+            out_char('\0');
+            out_write(owner, strlen(owner) + 1);
+            out_write(group, strlen(group) + 1);
+            out_num(st->st_size, 0);
+            out_char('\0');
+            if (when)
+                out_num(*when, 0);
+            out_char('\0');
+            out_write(dir, dir_len + 1);
+            out_write(entry_name(l, fe), fe->name_len);
+            out_char('\0');
+            continue;
+        }
+
+        out_lit("{\"mode\":\"");
+        out_write(perms, 10);
+        out_lit("\",\"nlink\":");
+        out_num(st->st_nlink, 0);
+        out_lit(",\"owner\":");
+        out_json_str(owner, strlen(owner));
+        out_lit(",\"group\":");
+        out_json_str(group, strlen(group));
+        out_lit(",\"size\":");
+        out_num(st->st_size, 0);
+        if (time_field == TIME_BIRTH)
+            out_lit(",\"btime\":");
+        else
+            out_lit(",\"mtime\":");
+        if (when)
+            out_num(*when, 0);
+        else
+            out_lit("null");
+        out_lit(",\"dir\":");
+        out_json_str(dir, dir_len);
+        out_lit(",\"name\":");
+        out_json_str(entry_name(l, fe), fe->name_len);
+        out_lit("}\n");
+    }
+}
+
+// An entry of the column layouts, after its -s size if size_width is set
+static void print_sized(const struct entry_list *l, struct file_entry *fe, int size_width) {
+    if (size_width) {
+        const struct stat_slot *slot = &l->slots[fe->stat_idx];
+        out_num(slot->err ? 0 : blocks_kib(slot->st.st_blocks), size_width);
+        out_char(' ');
+    }
+    print_colored(l, fe);
+}
+
+static void render_listing(const char *path, const struct entry_list *l, int display) {
+    struct file_entry *files = l->ents;
+    size_t count = l->count;
+    if (display >= DISPLAY_NDJSON) {
+        // Every record carries its directory; there is no header
+        list_records(path, l, display);
+        if (out_interactive)
+            out_flush();
+        return;
+    }
+
+    out_char('\n');
+    out_str(path);
+    out_write(":\n", 2);
+    if (show_blocks) {
+        out_write("total ", 6);
+        out_num(blocks_kib(l->blocks), 0);
+        out_char('\n');
+    }
+
+    if (display == DISPLAY_LONG) {
+        list_long(l);
+    } else if (count > 0) {
+        struct arena_mark mark = arena_get_mark(&arena);
+        size_t width = terminal_width();
+        uint16_t *col_width = arena_alloc(&arena, layout_max_cols(count, width) * sizeof(uint16_t));
+        if (!col_width) {
+            perror("malloc failed");
+            arena_release(&arena, mark);
+            if (out_interactive)
+                out_flush();
+            return;
+        }
+
+        // -s puts the size and a space in front of every name
+        int size_width = show_blocks ? blocks_width(l) : 0;
+        size_t extra = size_width ? size_width + 1 : 0;
+
+        if (display == DISPLAY_HORIZONTAL) {
+            int phase = stats_begin(PHASE_LAYOUT);
+            size_t cols = layout_horizontal(l, extra, width, col_width);
+            stats_end(phase);
+            for (size_t i = 0; i < count; i++) {
+                size_t col = i % cols;
+                print_sized(l, &files[i], size_width);
+                if (col + 1 < cols && i + 1 < count)
+                    out_spaces(col_width[col] + SPACING - files[i].width - extra);
+                else
+                    out_char('\n');
+            }
+        } else {
+            int phase = stats_begin(PHASE_LAYOUT);
+            size_t rows = layout_vertical(l, extra, width, col_width);
+            stats_end(phase);
+            for (size_t row = 0; row < rows; row++) {
+                for (size_t idx = row, col = 0; idx < count; idx += rows, col++) {
+                    print_sized(l, &files[idx], size_width);
+                    if (idx + rows < count)
+                        out_spaces(col_width[col] + SPACING - files[idx].width - extra);
+                }
+                out_char('\n');
+            }
+        }
+        arena_release(&arena, mark);
+    }
+
+    if (out_interactive)
+        out_flush();
+}
+
+// Print the header and entries of one directory. path is only used for the
+// header; l->dirfd is used to stat entries whose mode is not known yet.
+void print_listing(const char *path, const struct entry_list *l, int display) {
+    int phase = stats_begin(PHASE_RENDER);
+    render_listing(path, l, display);
+    stats_end(phase);
+}
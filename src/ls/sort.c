@@ -0,0 +1,319 @@
+#include "ls.h"
+
+/*
+ * Sort engine
+ *
+ * Instead of qsort() chasing two name pointers per comparison, entries are
+ * sorted through a contiguous array of {8-byte key, string, index}
+ * records. For a name the key is its first 8 bytes loaded big-endian, so
+ * comparing keys as integers gives the same order as strcmp() on those
+ * bytes. Big directories get an LSD radix sort on the key (passes where
+ * every record has the same byte are skipped), and only runs of equal keys
+ * fall back to comparing the rest. The entries are then gathered into the
+ * sorted order in one pass, backwards for -r.
+ *
+ * When the locale has a real collation order, the string is the strxfrm()
+ * of the name, computed once per entry rather than once per comparison.
+ *
+ * The other orders fit the same records:
+ *
+ *   -t, -S   the key is the time or size, inverted so the newest or largest
+ *            comes first, worked out by stat_entry() as each entry is
+ *            stat'ed. A big run of equal keys (empty files, a coarse clock)
+ *            is keyed again by name and radix sorted like a directory.
+ *   -X       the string is the extension, a \1 and the name, sorted as a
+ *            name. Extensions compare bytewise.
+ *   -v       the key is the name up to its first digit; equal keys are
+ *            ordered by version_compare().
+ *
+ * Each order has its own comparator, generated by SORT_COMPARE, so the
+ * options are looked at once per sort and never per comparison. Every
+ * comparator ends with the index, which makes the whole sort stable.
+ */
+struct sort_order {
+    int (*compare)(const void *, const void *);
+    const struct sort_order *then;  // order of runs of equal keys, if radix sorted again
+    int whole_key;                  // the key holds all of a string ending in its first 8 bytes
+};
+
+int sort_collate = 0;           // use strxfrm() keys (non-C LC_COLLATE)
+int sort_key = SORT_NAME;
+int sort_reverse = 0;
+
+static const struct sort_order *order;  // picked by sort_init()
+static int order_sign;                  // -1 for -r
+
+static uint64_t key_prefix(const char *key) {
+    uint64_t p = 0;
+    int i = 0;
+    for (; i < 8 && key[i]; i++)
+        p = (p << 8) | (unsigned char)key[i];
+    return p << (8 * (8 - i));
+}
+
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// The bytes of a name before its first digit, as key_prefix() loads them
+static uint64_t version_prefix(const char *name) {
+    uint64_t p = 0;
+    int i = 0;
+    for (; i < 8 && name[i] && !is_digit(name[i]); i++)
+        p = (p << 8) | (unsigned char)name[i];
+    return p << (8 * (8 - i));
+}
+
+// Natural order: digit runs compare as numbers, everything else bytewise.
+// Where one name has a digit run and the other does not, the end of the
+// name comes first, then the digits, then any other byte, so names with
+// the same version_prefix() are the only ones that need this. Numbers
+// equal but for leading zeros leave it to strcmp().
+static int version_compare(const char *a, const char *b) {
+    const char *name_a = a, *name_b = b;
+    for (;;) {
+        while (*a && *a == *b && !is_digit(*a)) {
+            a++;
+            b++;
+        }
+        if (!is_digit(*a) || !is_digit(*b)) {
+            int ra = !*a ? 0 : is_digit(*a) ? 1 : 2;
+            int rb = !*b ? 0 : is_digit(*b) ? 1 : 2;
+            if (ra != rb)
+                return ra - rb;
+            if (ra == 0)
+                return strcmp(name_a, name_b);
+            return (unsigned char)*a - (unsigned char)*b;
+        }
+
+        // Leading zeros aside, the longer number is the bigger one
+        while (*a == '0')
+            a++;
+        while (*b == '0')
+            b++;
+        size_t la = 0, lb = 0;
+        while (is_digit(a[la]))
+            la++;
+        while (is_digit(b[lb]))
+            lb++;
+        if (la != lb)
+            return la < lb ? -1 : 1;
+        int c = memcmp(a, b, la);
+        if (c != 0)
+            return c;
+        a += la;
+        b += lb;
+    }
+}
+
+#define SORT_COMPARE(name, tie)                                                 \
+    static int compare_##name(const void *a, const void *b) {                  \
+        const struct sort_rec *ra = a;                                          \
+        const struct sort_rec *rb = b;                                          \
+        int c;                                                                  \
+        if (ra->key != rb->key)                                                 \
+            return ra->key < rb->key ? -1 : 1;                                  \
+        if ((c = (tie)) != 0)                                                   \
+            return c;                                                           \
+        return ra->idx < rb->idx ? -1 : ra->idx > rb->idx;                      \
+    }
+
+// Equal keys that end inside the first 8 bytes are equal strings
+SORT_COMPARE(name, (ra->key & 0xff) == 0 ? 0 : strcmp(ra->str + 8, rb->str + 8))
+SORT_COMPARE(stat, strcmp(ra->str, rb->str))
+SORT_COMPARE(version, version_compare(ra->str, rb->str))
+
+static const struct sort_order by_name = { compare_name, NULL, 1 };
+static const struct sort_order by_stat = { compare_stat, &by_name, 0 };
+static const struct sort_order by_version = { compare_version, NULL, 0 };
+
+static void radix_sort_recs(struct sort_rec *recs, struct sort_rec *tmp, size_t n) {
+    size_t counts[8][256] = { { 0 } };
+    for (size_t i = 0; i < n; i++) {
+        uint64_t p = recs[i].key;
+        for (int b = 0; b < 8; b++)
+            counts[b][(p >> (8 * b)) & 0xff]++;
+    }
+
+    struct sort_rec *src = recs, *dst = tmp;
+    for (int b = 0; b < 8; b++) {
+        size_t *c = counts[b];
+        if (c[(src[0].key >> (8 * b)) & 0xff] == n)
+            continue;
+
+        size_t sum = 0;
+        for (int v = 0; v < 256; v++) {
+            size_t cnt = c[v];
+            c[v] = sum;
+            sum += cnt;
+        }
+        for (size_t i = 0; i < n; i++)
+            dst[c[(src[i].key >> (8 * b)) & 0xff]++] = src[i];
+
+        struct sort_rec *t = src;
+        src = dst;
+        dst = t;
+    }
+
+    if (src != recs)
+        memcpy(recs, src, n * sizeof(struct sort_rec));
+}
+
+// Sort recs in order o; tmp has room for n records.
+static void sort_recs(struct sort_rec *recs, struct sort_rec *tmp, size_t n,
+                      const struct sort_order *o) {
+    if (n < RADIX_SORT_MIN) {
+        qsort(recs, n, sizeof(struct sort_rec), o->compare);
+        return;
+    }
+    radix_sort_recs(recs, tmp, n);
+
+    // Only runs sharing the whole key need another look
+    for (size_t i = 0; i < n; ) {
+        size_t j = i + 1;
+        while (j < n && recs[j].key == recs[i].key)
+            j++;
+        if (j - i > 1 && o->then) {
+            for (size_t k = i; k < j; k++)
+                recs[k].key = key_prefix(recs[k].str);
+            sort_recs(recs + i, tmp, j - i, o->then);
+        } else if (j - i > 1 && !(o->whole_key && (recs[i].key & 0xff) == 0)) {
+            qsort(recs + i, j - i, sizeof(struct sort_rec), o->compare);
+        }
+        i = j;
+    }
+}
+
+// The -t or -S key of an entry whose stat is in slot; 0 for other orders.
+// Entries that could not be stat'ed come last.
+uint64_t stat_sort_key(const struct stat_slot *slot) {
+    if (slot->err)
+        return UINT64_MAX;
+    if (sort_key == SORT_SIZE)
+        return ~(uint64_t)slot->st.st_size;
+    if (sort_key != SORT_TIME)
+        return 0;
+
+    const struct timespec *ts = time_field == TIME_BIRTH ? &slot->btime : &slot->st.st_mtim;
+    if (ts->tv_nsec < 0)
+        return UINT64_MAX;
+    // 34 bits of seconds around the epoch (about 1698 to 2242), then the
+    // nanoseconds; times outside that range sort with its ends
+    int64_t sec = (int64_t)ts->tv_sec + ((int64_t)1 << 33);
+    if (sec < 0)
+        return UINT64_MAX;
+    if (sec >= (int64_t)1 << 34)
+        return 0;
+    return ~((uint64_t)sec << 30 | (uint64_t)ts->tv_nsec);
+}
+
+// Fill in the record of entry i of l, allocating any key strings from a.
+// Returns 0 or -1 if out of memory.
+int sort_rec_init(struct arena *a, const struct entry_list *l, size_t i,
+                  struct sort_rec *rec) {
+    const struct file_entry *fe = &l->ents[i];
+    const char *name = entry_name(l, fe);
+    rec->idx = i;
+
+    if (sort_key == SORT_VERSION) {
+        rec->key = version_prefix(name);
+        rec->str = name;
+        return 0;
+    }
+
+    const char *key = name;
+    size_t len = fe->name_len;
+    if (sort_collate) {
+        len = strxfrm(NULL, name, 0);
+        char *xfrm = arena_alloc(a, len + 1);
+        if (!xfrm)
+            return -1;
+        strxfrm(xfrm, name, len + 1);
+        key = xfrm;
+    }
+
+    if (sort_key == SORT_EXTENSION) {
+        const char *dot = strrchr(name, '.');
+        const char *ext = dot ? dot + 1 : name + fe->name_len;
+        size_t ext_len = name + fe->name_len - ext;
+        char *s = arena_alloc(a, ext_len + 1 + len + 1);
+        if (!s)
+            return -1;
+        memcpy(s, ext, ext_len);
+        s[ext_len] = '\1';
+        memcpy(s + ext_len + 1, key, len + 1);
+        key = s;
+    }
+
+    rec->str = key;
+    rec->key = sort_key == SORT_TIME || sort_key == SORT_SIZE ?
+               l->slots[fe->stat_idx].sort_key : key_prefix(key);
+    return 0;
+}
+
+static int sort_list(struct arena *a, struct entry_list *l) {
+    struct file_entry *files = l->ents;
+    size_t count = l->count;
+    if (count < 2)
+        return 0;
+
+    struct arena_mark mark = arena_get_mark(a);
+    struct sort_rec *recs = arena_alloc(a, count * sizeof(struct sort_rec));
+    struct sort_rec *tmp = count >= RADIX_SORT_MIN ?
+                           arena_alloc(a, count * sizeof(struct sort_rec)) : NULL;
+    if (!recs || (count >= RADIX_SORT_MIN && !tmp)) {
+        arena_release(a, mark);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (sort_rec_init(a, l, i, &recs[i]) == -1) {
+            arena_release(a, mark);
+            return -1;
+        }
+    }
+
+    sort_recs(recs, tmp, count, order);
+
+    struct file_entry *sorted = arena_alloc(a, count * sizeof(struct file_entry));
+    if (!sorted) {
+        arena_release(a, mark);
+        return -1;
+    }
+    if (sort_reverse) {
+        for (size_t i = 0; i < count; i++)
+            sorted[count - 1 - i] = files[recs[i].idx];
+    } else {
+        for (size_t i = 0; i < count; i++)
+            sorted[i] = files[recs[i].idx];
+    }
+    memcpy(files, sorted, count * sizeof(struct file_entry));
+
+    arena_release(a, mark);
+    return 0;
+}
+
+// Pick the order of the sort options. Call before anything is sorted.
+void sort_init(void) {
+    order = &by_name;
+    if (sort_key == SORT_TIME || sort_key == SORT_SIZE)
+        order = &by_stat;
+    else if (sort_key == SORT_VERSION)
+        order = &by_version;
+    order_sign = sort_reverse ? -1 : 1;
+}
+
+// Compare two records in listing order, -r included
+int sort_compare(const struct sort_rec *a, const struct sort_rec *b) {
+    return order_sign * order->compare(a, b);
+}
+
+// Sort the entries of l in the order of the sort options. With -t and -S
+// every entry must have been stat'ed. Scratch space comes from a and is
+// released on return.
+int sort_entries(struct arena *a, struct entry_list *l) {
+    int phase = stats_begin(PHASE_SORT);
+    int rc = sort_list(a, l);
+    stats_end(phase);
+    return rc;
+}
@@ -0,0 +1,228 @@
+#include "ls.h"
+
+/*
+ * Field-masked stats
+ *
+ * Every stat asks statx() for just the fields its caller uses: the type
+ * for -R, type and mode for colors, the printed fields for -l. On network
+ * and FUSE filesystems AT_STATX_DONT_SYNC lets the client answer from its
+ * attribute cache instead of revalidating each entry with the server.
+ */
+static __thread int stat_sync_flags;    // for the directory this thread is reading
+
+#ifdef HAVE_STATX
+// Filesystems whose attributes are owned by a server
+static const unsigned long remote_fs_magic[] = {
+    0x6969,         // NFS
+    0x517b,         // SMB
+    0xff534d42,     // CIFS
+    0xfe534d42,     // SMB2
+    0x65735546,     // FUSE
+    0x00c36400,     // Ceph
+    0x5346414f,     // AFS
+    0x01021997,     // 9P
+};
+#endif
+
+// Pick the sync flags for stats of entries in dirfd on this thread.
+void stat_dir_begin(int dirfd) {
+#ifdef HAVE_STATX
+    struct statfs sfs;
+    stat_sync_flags = 0;
+    stats_count(STATS_FSTATFS);
+    if (fstatfs(dirfd, &sfs) == -1)
+        return;
+    for (size_t i = 0; i < sizeof(remote_fs_magic) / sizeof(remote_fs_magic[0]); i++) {
+        if ((unsigned long)sfs.f_type == remote_fs_magic[i])
+            stat_sync_flags = AT_STATX_DONT_SYNC;
+    }
+#else
+    (void)dirfd;
+#endif
+}
+
+// lstat() name in dirfd, fetching at least the fields in mask into st.
+// btime, if given, gets the birth time. Returns 0 or -1 with errno set.
+static int stat_fields(int dirfd, const char *name, unsigned int mask, struct stat *st,
+                struct timespec *btime) {
+#ifdef HAVE_STATX
+    struct statx stx;
+    int phase = stats_begin(PHASE_STAT);
+    int rc = statx(dirfd, name, AT_SYMLINK_NOFOLLOW | stat_sync_flags, mask, &stx);
+    stats_end(phase);
+    stats_count(STATS_STAT);
+    if (rc == -1)
+        return -1;
+
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st->st_ino = stx.stx_ino;
+    st->st_mode = stx.stx_mode;
+    st->st_nlink = stx.stx_nlink;
+    st->st_uid = stx.stx_uid;
+    st->st_gid = stx.stx_gid;
+    st->st_size = stx.stx_size;
+    st->st_blocks = stx.stx_blocks;
+    st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+    if (btime) {
+        btime->tv_sec = stx.stx_btime.tv_sec;
+        btime->tv_nsec = (stx.stx_mask & STATX_BTIME) ? (long)stx.stx_btime.tv_nsec : -1;
+    }
+#else
+    (void)mask;
+    int phase = stats_begin(PHASE_STAT);
+    int rc = fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW);
+    stats_end(phase);
+    stats_count(STATS_STAT);
+    if (rc == -1)
+        return -1;
+    if (btime)
+        btime->tv_nsec = -1;
+#endif
+    return 0;
+}
+
+// Return the mode of an entry, calling lstat() only when d_type is missing
+// or the permission bits are needed. The result is cached in the entry.
+// Returns 0 if the file cannot be inspected.
+mode_t entry_mode(const struct entry_list *l, struct file_entry *fe, int need_perms) {
+    if (fe->mode)
+        return fe->mode;
+    if (fe->type != DT_UNKNOWN && !need_perms)
+        return DTTOIF(fe->type);
+
+    // dirfd is -1 once the directory is closed; only cached modes are left
+    struct stat st;
+    unsigned int mask = need_perms ? STATX_TYPE | STATX_MODE : STATX_TYPE;
+    if (l->dirfd < 0 || stat_fields(l->dirfd, entry_name(l, fe), mask, &st, NULL) == -1)
+        return 0;
+
+    // Without the permission bits only the type is worth keeping
+    fe->type = IFTODT(st.st_mode);
+    if (!need_perms)
+        return DTTOIF(fe->type);
+    fe->mode = st.st_mode;
+    return fe->mode;
+}
+
+// Resolve the file type of an entry, trusting d_type when the filesystem
+// provides it. Returns DT_UNKNOWN if the file cannot be inspected.
+unsigned char resolve_type(const struct entry_list *l, struct file_entry *fe) {
+    if (fe->type == DT_UNKNOWN)
+        entry_mode(l, fe, 0);
+    return fe->type;
+}
+
+// Stat an entry into slot, working out its sort key while the fields are
+// at hand
+void stat_entry(const struct entry_list *l, struct file_entry *fe, struct stat_slot *slot) {
+    if (stat_fields(l->dirfd, entry_name(l, fe), long_mask, &slot->st, &slot->btime) == -1) {
+        slot->err = errno;
+    } else {
+        slot->err = 0;
+        fe->mode = slot->st.st_mode;
+        fe->type = IFTODT(slot->st.st_mode);
+    }
+    slot->sort_key = stat_sort_key(slot);
+}
+
+/*
+ * Stat prefetch for -l
+ *
+ * On cold caches and network filesystems every lstat() is a blocking round
+ * trip, so the stats of a directory are issued from a small pool of threads
+ * before formatting starts. Workers (and the caller) claim STAT_BATCH
+ * entries at a time from a shared counter. The pool is started on the first
+ * directory big enough to need it and lives until the process exits.
+ */
+struct stat_job {
+    struct entry_list *list;
+    int sync_flags;         // stat_sync_flags of the submitting thread
+    size_t next;            // next index to claim, advanced atomically
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv;
+    pthread_cond_t done_cv;
+    struct stat_job *job;
+    unsigned long generation;   // bumped for every new job
+    int busy;                   // workers still on the current job
+    int nworkers;
+} stat_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0 };
+
+static void run_stat_job(struct stat_job *job) {
+    stat_sync_flags = job->sync_flags;
+    for (;;) {
+        struct entry_list *l = job->list;
+        size_t i = __atomic_fetch_add(&job->next, STAT_BATCH, __ATOMIC_RELAXED);
+        if (i >= l->count)
+            break;
+        size_t end = i + STAT_BATCH < l->count ? i + STAT_BATCH : l->count;
+        for (; i < end; i++) {
+            l->ents[i].stat_idx = i;
+            stat_entry(l, &l->ents[i], &l->slots[i]);
+        }
+    }
+}
+
+static void *stat_worker_main(void *arg) {
+    (void)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&stat_pool.lock);
+    for (;;) {
+        while (stat_pool.generation == seen)
+            pthread_cond_wait(&stat_pool.work_cv, &stat_pool.lock);
+        seen = stat_pool.generation;
+        struct stat_job *job = stat_pool.job;
+        pthread_mutex_unlock(&stat_pool.lock);
+
+        run_stat_job(job);
+
+        pthread_mutex_lock(&stat_pool.lock);
+        if (--stat_pool.busy == 0)
+            pthread_cond_signal(&stat_pool.done_cv);
+    }
+    return NULL;
+}
+
+static void stat_pool_start(void) {
+    for (int i = 1; i < stat_threads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, stat_worker_main, NULL) != 0)
+            break;
+        pthread_detach(tid);
+        stat_pool.nworkers++;
+    }
+}
+
+// Stat every entry of l into l->slots, in parallel for big directories.
+void prefetch_stats(struct entry_list *l) {
+    struct stat_job job = { l, stat_sync_flags, 0 };
+    size_t count = l->count;
+
+    if (count >= STAT_PREFETCH_MIN && stat_threads > 1 && stat_pool.nworkers == 0)
+        stat_pool_start();
+
+    if (count < STAT_PREFETCH_MIN || stat_pool.nworkers == 0) {
+        run_stat_job(&job);
+        return;
+    }
+
+    pthread_mutex_lock(&stat_pool.lock);
+    stat_pool.job = &job;
+    stat_pool.busy = stat_pool.nworkers;
+    stat_pool.generation++;
+    pthread_cond_broadcast(&stat_pool.work_cv);
+    pthread_mutex_unlock(&stat_pool.lock);
+
+    run_stat_job(&job);
+
+    pthread_mutex_lock(&stat_pool.lock);
+    while (stat_pool.busy > 0)
+        pthread_cond_wait(&stat_pool.done_cv, &stat_pool.lock);
+    pthread_mutex_unlock(&stat_pool.lock);
+}
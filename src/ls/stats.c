@@ -0,0 +1,123 @@
+#include "ls.h"
+
+/*
+ * Run statistics (--stats)
+ *
+ * Every thread counts into its own block, registered on its first count
+ * and summed when the run ends, so workers never share a cache line. Time
+ * is charged to one phase at a time: entering a phase reads the clock,
+ * charges the time since the last switch to the phase being left, and
+ * returns it so the caller can switch back. Nested phases (a stat while
+ * rendering, a flush while laying out) are therefore never counted
+ * twice. Time spent outside any phase, including waiting for work, is
+ * not reported.
+ *
+ * The syscalls counted are those of the listing itself: opening, reading
+ * and closing directories, the stats, the symlink checks of colors and
+ * the writes. The cache file, the terminal size and inotify are left out.
+ * Heap allocations are counted at every malloc outside the arenas.
+ *
+ * Without --stats every hook is a single predictable branch on show_stats.
+ */
+int show_stats = 0;
+__thread struct thread_stats *thread_stats;
+
+static struct {
+    pthread_mutex_t lock;
+    struct thread_stats *threads;
+    uint64_t started;
+} stats = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static const char *const phase_names[PHASE_COUNT] = {
+    NULL, "enumerate", "stat", "sort", "layout", "render", "write"
+};
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+struct thread_stats *stats_register(void) {
+    // Counting is best effort; without memory this thread goes uncounted
+    struct thread_stats *t = calloc(1, sizeof(struct thread_stats));
+    if (!t)
+        return NULL;
+    t->phase_start = stats_now();
+    pthread_mutex_lock(&stats.lock);
+    t->next = stats.threads;
+    stats.threads = t;
+    pthread_mutex_unlock(&stats.lock);
+    thread_stats = t;
+    return t;
+}
+
+int stats_switch(int phase) {
+    struct thread_stats *t = stats_self();
+    if (!t)
+        return PHASE_IDLE;
+    uint64_t now = stats_now();
+    int prev = t->phase;
+    t->phase_ns[prev] += now - t->phase_start;
+    t->phase = phase;
+    t->phase_start = now;
+    return prev;
+}
+
+void stats_start(void) {
+    stats.started = stats_now();
+}
+
+static double ms(uint64_t ns) {
+    return ns / 1e6;
+}
+
+void print_stats(void) {
+    out_flush();
+    uint64_t wall = stats_now() - stats.started;
+
+    struct thread_stats sum = { 0 };
+    size_t nthreads = 0;
+    pthread_mutex_lock(&stats.lock);
+    for (struct thread_stats *t = stats.threads; t; t = t->next, nthreads++) {
+        for (int i = 0; i < STATS_COUNTERS; i++)
+            sum.counters[i] += t->counters[i];
+        for (int i = 0; i < PHASE_COUNT; i++)
+            sum.phase_ns[i] += t->phase_ns[i];
+        if (t->peak_entries > sum.peak_entries)
+            sum.peak_entries = t->peak_entries;
+    }
+    pthread_mutex_unlock(&stats.lock);
+    // The current phase of this thread is still open
+    if (thread_stats)
+        sum.phase_ns[thread_stats->phase] += stats_now() - thread_stats->phase_start;
+
+    fprintf(stderr, "time: %.2f ms wall, %zu threads\n", ms(wall), nthreads);
+    fprintf(stderr, "phases:");
+    for (int i = PHASE_IDLE + 1; i < PHASE_COUNT; i++)
+        fprintf(stderr, "%s %s %.2f ms", i > PHASE_IDLE + 1 ? "," : "", phase_names[i],
+                ms(sum.phase_ns[i]));
+    fprintf(stderr, "\n");
+    fprintf(stderr, "syscalls: %" PRIu64 " open, %" PRIu64 " getdents64, %" PRIu64 " stat, %"
+            PRIu64 " fstat, %" PRIu64 " fstatfs, %" PRIu64 " faccessat, %" PRIu64 " write, %"
+            PRIu64 " close\n",
+            sum.counters[STATS_OPEN], sum.counters[STATS_GETDENTS], sum.counters[STATS_STAT],
+            sum.counters[STATS_FSTAT], sum.counters[STATS_FSTATFS], sum.counters[STATS_ACCESS],
+            sum.counters[STATS_WRITE], sum.counters[STATS_CLOSE]);
+    fprintf(stderr, "visited: %" PRIu64 " directories, %" PRIu64 " entries\n",
+            sum.counters[STATS_DIRS], sum.counters[STATS_ENTRIES]);
+    fprintf(stderr, "output: %" PRIu64 " bytes written\n", sum.counters[STATS_BYTES]);
+    fprintf(stderr, "entry array: peak %" PRIu64 " entries, %zu bytes\n",
+            sum.peak_entries, (size_t)sum.peak_entries * sizeof(struct file_entry));
+    fprintf(stderr, "arena: peak %zu bytes, reserved %zu bytes, %zu chunk mallocs\n",
+            arena.peak, arena.reserved, arena.chunk_mallocs);
+    fprintf(stderr, "heap: %" PRIu64 " mallocs outside the arenas\n", sum.counters[STATS_MALLOCS]);
+    fprintf(stderr, "walk: depth %zu, %zu directories reopened, names peak %zu bytes\n",
+            walk_stats.max_depth, walk_stats.reopens, name_arena.peak);
+    fprintf(stderr, "user cache: %zu hits, %zu misses\n", user_cache.hits, user_cache.misses);
+    fprintf(stderr, "group cache: %zu hits, %zu misses\n", group_cache.hits, group_cache.misses);
+    if (show_blocks)
+        fprintf(stderr, "usage: %zu entries summed, %zu hard links counted once\n",
+                usage_stats.entries, usage_stats.links);
+    snap_print_stats();
+}
@@ -0,0 +1,210 @@
+#include "ls.h"
+
+/*
+ * Time formatting for -l (--time-style)
+ *
+ * The broken-down date of a local day is worked out once, with
+ * localtime_r() and mktime(), and kept in a bucket covering that day; a
+ * time within it is its offset from midnight, so hours and minutes are a
+ * division away. Buckets are direct mapped by day number. A day whose UTC
+ * offset changes (a DST switch) has no fixed midnight offsets and is
+ * formatted with localtime_r() on every call instead.
+ *
+ * As in ls, the default and locale styles print "Mon DD HH:MM" for times
+ * in the last six months and "Mon DD  YYYY" otherwise, including times in
+ * the future. Every cache belongs to one thread; the style and month
+ * names are set once before listing starts and only read afterwards.
+ */
+#define SIX_MONTHS (31556952 / 2)   // half of an average Gregorian year
+
+int time_style = TIME_STYLE_DEFAULT;
+
+static struct {
+    char months[12][TIME_MONTH_MAX];
+    unsigned char month_len[12];    // bytes, padded to the widest name
+} time_names = {
+    { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" },
+    { 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3 }
+};
+static size_t month_width = 3;      // display width of every padded name
+
+// Take the month abbreviations of LC_TIME for the locale style, padded to
+// the same width so the columns stay aligned. Call after setlocale().
+// Names that do not fit leave the C names in place.
+void time_format_init(void) {
+    if (time_style != TIME_STYLE_LOCALE)
+        return;
+
+    size_t width[12], max_width = 0;
+    for (int i = 0; i < 12; i++) {
+        const char *name = nl_langinfo(ABMON_1 + i);
+        size_t len = strlen(name);
+        if (len == 0 || len > TIME_MONTH_MAX / 2)
+            return;
+        width[i] = display_width(name, len);
+        if (width[i] > max_width)
+            max_width = width[i];
+    }
+    for (int i = 0; i < 12; i++) {
+        const char *name = nl_langinfo(ABMON_1 + i);
+        size_t len = strlen(name);
+        memcpy(time_names.months[i], name, len);
+        memset(time_names.months[i] + len, ' ', max_width - width[i]);
+        time_names.month_len[i] = len + max_width - width[i];
+    }
+    month_width = max_width;
+}
+
+// Width of a formatted time in terminal cells
+size_t time_width(void) {
+    switch (time_style) {
+        case TIME_STYLE_ISO: return 11;
+        case TIME_STYLE_LONG_ISO: return 16;
+        case TIME_STYLE_FULL_ISO: return 35;
+        default: return month_width + 9;
+    }
+}
+
+static char *put2(char *p, unsigned int v) {
+    p[0] = '0' + v / 10 % 10;
+    p[1] = '0' + v % 10;
+    return p + 2;
+}
+
+static char *put_year(char *p, int year) {
+    if (year < 0 || year > 9999) {
+        char tmp[16];
+        int n = snprintf(tmp, sizeof(tmp), "%d", year);
+        memcpy(p, tmp, n);
+        return p + n;
+    }
+    p = put2(p, year / 100);
+    return put2(p, year % 100);
+}
+
+// The date part of a time: for a recent time everything before the clock,
+// otherwise the whole text. recent is ignored by the ISO styles with a
+// clock on every line.
+static size_t format_date(const struct tm *tm, int recent, char *buf) {
+    char *p = buf;
+    if (time_style == TIME_STYLE_ISO && recent) {
+        p = put2(p, tm->tm_mon + 1);
+        *p++ = '-';
+        p = put2(p, tm->tm_mday);
+        *p++ = ' ';
+    } else if (time_style >= TIME_STYLE_ISO) {
+        // For an old iso time the trailing space stands in for the clock
+        p = put_year(p, tm->tm_year + 1900);
+        *p++ = '-';
+        p = put2(p, tm->tm_mon + 1);
+        *p++ = '-';
+        p = put2(p, tm->tm_mday);
+        *p++ = ' ';
+    } else {
+        memcpy(p, time_names.months[tm->tm_mon], time_names.month_len[tm->tm_mon]);
+        p += time_names.month_len[tm->tm_mon];
+        *p++ = ' ';
+        *p++ = tm->tm_mday < 10 ? ' ' : '0' + tm->tm_mday / 10;
+        *p++ = '0' + tm->tm_mday % 10;
+        *p++ = ' ';
+        if (!recent) {
+            int year = tm->tm_year + 1900;
+            if (year >= 0 && year <= 9999)
+                *p++ = ' ';
+            p = put_year(p, year);
+        }
+    }
+    return p - buf;
+}
+
+// "HH:MM", or "HH:MM:SS.NNNNNNNNN +hhmm" for full-iso
+static size_t format_clock(unsigned int sec_of_day, long nsec, long gmtoff, char *buf) {
+    char *p = put2(buf, sec_of_day / 3600);
+    *p++ = ':';
+    p = put2(p, sec_of_day / 60 % 60);
+    if (time_style == TIME_STYLE_FULL_ISO) {
+        *p++ = ':';
+        p = put2(p, sec_of_day % 60);
+        *p++ = '.';
+        for (long div = 100000000; div > 0; div /= 10)
+            *p++ = '0' + nsec / div % 10;
+        *p++ = ' ';
+        *p++ = gmtoff < 0 ? '-' : '+';
+        unsigned long off = gmtoff < 0 ? -gmtoff : gmtoff;
+        p = put2(p, off / 3600);
+        p = put2(p, off / 60 % 60);
+    }
+    return p - buf;
+}
+
+static int time_recent(struct time_cache *c, time_t t) {
+    if (time_style == TIME_STYLE_LONG_ISO || time_style == TIME_STYLE_FULL_ISO)
+        return 1;
+    // A file may have been touched since the clock was read; look again
+    if (!c->now || t > c->now)
+        c->now = time(NULL);
+    return t > c->now - SIX_MONTHS && t <= c->now;
+}
+
+static long floor_day(time_t t) {
+    return t >= 0 ? t / 86400 : -((-t + 86399) / 86400);
+}
+
+// The bucket holding t, computed on a miss. Returns NULL if the day of t
+// cannot be worked out.
+static struct time_bucket *time_bucket(struct time_cache *c, time_t t) {
+    long day = floor_day(t + c->gmtoff_hint);
+    for (long d = day - 1; d <= day + 1; d++) {
+        struct time_bucket *b = &c->buckets[d & (TIME_CACHE_SIZE - 1)];
+        if (b->end && t >= b->start && t < b->end)
+            return b;
+    }
+
+    struct tm tm, start, next;
+    if (!localtime_r(&t, &tm))
+        return NULL;
+    start = tm;
+    start.tm_hour = start.tm_min = start.tm_sec = 0;
+    start.tm_isdst = -1;
+    next = start;
+    next.tm_mday++;
+    time_t from = mktime(&start), to = mktime(&next);
+    if (from == (time_t)-1 || to == (time_t)-1 || t < from || t >= to)
+        return NULL;
+
+    day = floor_day(from + start.tm_gmtoff);
+    struct time_bucket *b = &c->buckets[day & (TIME_CACHE_SIZE - 1)];
+    b->start = from;
+    b->end = to;
+    b->regular = to - from == 86400 && start.tm_gmtoff == next.tm_gmtoff;
+    b->gmtoff = start.tm_gmtoff;
+    b->recent_len = format_date(&start, 1, b->recent);
+    b->old_len = format_date(&start, 0, b->old);
+    c->gmtoff_hint = start.tm_gmtoff;
+    return b;
+}
+
+// Format ts in the current style into buf (TIME_TEXT_MAX bytes, not
+// terminated). Returns the length, 0 if the time cannot be converted.
+size_t format_time(struct time_cache *c, const struct timespec *ts, char *buf) {
+    time_t t = ts->tv_sec;
+    struct time_bucket *b = time_bucket(c, t);
+    int recent = time_recent(c, t);
+    if (!b || !b->regular) {
+        struct tm tm;
+        if (!localtime_r(&t, &tm))
+            return 0;
+        size_t len = format_date(&tm, recent, buf);
+        if (recent)
+            len += format_clock(tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec, ts->tv_nsec,
+                                tm.tm_gmtoff, buf + len);
+        return len;
+    }
+
+    if (!recent) {
+        memcpy(buf, b->old, b->old_len);
+        return b->old_len;
+    }
+    memcpy(buf, b->recent, b->recent_len);
+    return b->recent_len + format_clock(t - b->start, ts->tv_nsec, b->gmtoff, buf + b->recent_len);
+}
@@ -0,0 +1,247 @@
+#include "ls.h"
+
+/*
+ * Top-N listing (--top=N)
+ *
+ * Only the first N entries of the listing are wanted, so nothing is
+ * sorted in full. Directories are streamed as for -U and every entry is
+ * offered to a max-heap of the N best seen so far, ordered by the sort
+ * options: its root is the entry that would be listed last. An entry that
+ * does not beat the root costs its sort key and one comparison; one that
+ * does replaces the root and is sifted down. Memory stays at N entries
+ * however big the directory or, with -R, the tree is, and time is
+ * O(n log N).
+ *
+ * -t and -S need a stat for the key; -l stats an entry only once it gets
+ * into the heap. Every entry keeps a reference to the path of its
+ * directory, freed with the last entry from there. At the end the heap is
+ * sorted and printed as runs of entries from the same directory, each
+ * under its header, so the ranking holds across the whole tree.
+ */
+struct top_dir {
+    size_t refs;            // entries in the heap, plus one while it is scanned
+    char path[];
+};
+
+struct top_item {
+    struct sort_rec rec;    // str points into buf
+    struct file_entry fe;   // its name at buf, name_off 0
+    struct stat_slot slot;  // if fe.stat_idx is 0
+    struct top_dir *dir;
+    char *buf;              // the name, then the sort string if it is another one
+    size_t buf_cap;
+};
+
+size_t top_count = 0;       // --top=N, 0 when listing everything
+
+static struct {
+    struct top_item *items;
+    struct top_item **heap; // heap[0] comes last in the listing
+    size_t len;
+    struct top_dir *dir;    // being scanned
+    size_t seen;            // entries offered, the last tie-break
+} top;
+
+static void top_dir_put(struct top_dir *d) {
+    if (d && --d->refs == 0)
+        free(d);
+}
+
+// Start on the directory at path. Returns 0 or -1 if out of memory.
+int top_enter(const char *path) {
+    if (!top.items) {
+        top.items = calloc(top_count, sizeof(struct top_item));
+        top.heap = calloc(top_count, sizeof(struct top_item *));
+        stats_add(STATS_MALLOCS, 2);
+        if (!top.items || !top.heap)
+            return -1;
+    }
+    size_t len = strlen(path);
+    top.dir = malloc(sizeof(struct top_dir) + len + 1);
+    stats_count(STATS_MALLOCS);
+    if (!top.dir)
+        return -1;
+    top.dir->refs = 1;
+    memcpy(top.dir->path, path, len + 1);
+    return 0;
+}
+
+void top_leave(void) {
+    top_dir_put(top.dir);
+    top.dir = NULL;
+}
+
+static int top_before(const struct top_item *a, const struct top_item *b) {
+    return sort_compare(&a->rec, &b->rec) < 0;
+}
+
+static void heap_up(size_t i) {
+    struct top_item *it = top.heap[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!top_before(top.heap[parent], it))
+            break;
+        top.heap[i] = top.heap[parent];
+        i = parent;
+    }
+    top.heap[i] = it;
+}
+
+static void heap_down(size_t i) {
+    struct top_item *it = top.heap[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= top.len)
+            break;
+        if (child + 1 < top.len && top_before(top.heap[child], top.heap[child + 1]))
+            child++;
+        if (!top_before(it, top.heap[child]))
+            break;
+        top.heap[i] = top.heap[child];
+        i = child;
+    }
+    top.heap[i] = it;
+}
+
+// Copy the entry of one, with its sort record rec, into it
+static int top_fill(struct top_item *it, const struct entry_list *one, const struct sort_rec *rec) {
+    const struct file_entry *fe = &one->ents[0];
+    const char *name = entry_name(one, fe);
+    size_t str_len = rec->str != name ? strlen(rec->str) + 1 : 0;
+    size_t need = fe->name_len + 1 + str_len;
+    if (need > it->buf_cap) {
+        size_t cap = it->buf_cap ? it->buf_cap : 64;
+        while (cap < need)
+            cap *= 2;
+        char *buf = realloc(it->buf, cap);
+        stats_count(STATS_MALLOCS);
+        if (!buf)
+            return -1;
+        it->buf = buf;
+        it->buf_cap = cap;
+    }
+
+    memcpy(it->buf, name, fe->name_len + 1);
+    it->rec = *rec;
+    it->rec.str = it->buf;
+    if (str_len) {
+        it->rec.str = it->buf + fe->name_len + 1;
+        memcpy(it->buf + fe->name_len + 1, rec->str, str_len);
+    }
+    it->fe = *fe;
+    it->fe.name_off = 0;
+    it->fe.width = display_width(name, fe->name_len);
+    if (fe->stat_idx != NO_STAT) {
+        it->slot = one->slots[fe->stat_idx];
+        it->fe.stat_idx = 0;
+    }
+    top_dir_put(it->dir);
+    it->dir = top.dir;
+    it->dir->refs++;
+    return 0;
+}
+
+// Offer the entry of the one-entry list one, whose slot is free to stat
+// into, to the heap
+void top_offer(struct entry_list *one, int display) {
+    struct file_entry *fe = &one->ents[0];
+    if (sort_key == SORT_TIME || sort_key == SORT_SIZE) {
+        fe->stat_idx = 0;
+        stat_entry(one, fe, &one->slots[0]);
+    }
+
+    struct arena_mark mark = arena_get_mark(&arena);
+    struct sort_rec rec;
+    if (sort_rec_init(&arena, one, 0, &rec) == -1) {
+        perror("malloc failed");
+        arena_release(&arena, mark);
+        return;
+    }
+    rec.idx = top.seen++;
+
+    if (top.len == top_count && sort_compare(&rec, &top.heap[0]->rec) >= 0) {
+        arena_release(&arena, mark);
+        return;
+    }
+
+    if (display >= DISPLAY_LONG && fe->stat_idx == NO_STAT) {
+        fe->stat_idx = 0;
+        stat_entry(one, fe, &one->slots[0]);
+    }
+    // The mode is only known while the directory is open
+    if (use_color && !color_prepare(one, fe))
+        perror("lstat failed");
+
+    int full = top.len == top_count;
+    struct top_item *it = full ? top.heap[0] : &top.items[top.len];
+    if (top_fill(it, one, &rec) == -1) {
+        perror("malloc failed");
+    } else if (full) {
+        heap_down(0);
+    } else {
+        top.heap[top.len++] = it;
+        heap_up(top.len - 1);
+    }
+    arena_release(&arena, mark);
+}
+
+static int compare_items(const void *a, const void *b) {
+    const struct top_item *ia = *(struct top_item *const *)a;
+    const struct top_item *ib = *(struct top_item *const *)b;
+    return sort_compare(&ia->rec, &ib->rec);
+}
+
+// Print the heap in listing order, a run of entries from one directory at
+// a time
+void top_print(int display) {
+    int phase = stats_begin(PHASE_SORT);
+    qsort(top.heap, top.len, sizeof(struct top_item *), compare_items);
+    stats_end(phase);
+
+    for (size_t i = 0; i < top.len; ) {
+        struct top_dir *dir = top.heap[i]->dir;
+        size_t j = i + 1, names_len = top.heap[i]->fe.name_len + 1;
+        for (; j < top.len && top.heap[j]->dir == dir; j++)
+            names_len += top.heap[j]->fe.name_len + 1;
+
+        struct arena_mark mark = arena_get_mark(&arena);
+        struct entry_list l = { NULL, j - i, NULL, NULL, 0, -1, 0 };
+        l.ents = arena_alloc(&arena, l.count * sizeof(struct file_entry));
+        l.slots = arena_alloc(&arena, l.count * sizeof(struct stat_slot));
+        char *names = arena_alloc(&arena, names_len);
+        if (!l.ents || !l.slots || !names) {
+            perror("malloc failed");
+            arena_release(&arena, mark);
+            return;
+        }
+        l.names = names;
+
+        size_t pos = 0;
+        for (size_t k = 0; k < l.count; k++) {
+            struct top_item *it = top.heap[i + k];
+            l.ents[k] = it->fe;
+            l.ents[k].name_off = pos;
+            memcpy(names + pos, it->buf, it->fe.name_len + 1);
+            pos += it->fe.name_len + 1;
+            if (it->fe.stat_idx != NO_STAT) {
+                l.slots[k] = it->slot;
+                l.ents[k].stat_idx = k;
+            }
+            if (it->fe.width > l.max_width)
+                l.max_width = it->fe.width;
+        }
+        print_listing(dir->path, &l, display);
+        arena_release(&arena, mark);
+        i = j;
+    }
+
+    for (size_t i = 0; i < top.len; i++) {
+        free(top.heap[i]->buf);
+        top_dir_put(top.heap[i]->dir);
+    }
+    free(top.items);
+    free(top.heap);
+    top.items = NULL;
+    top.heap = NULL;
+    top.len = 0;
+}
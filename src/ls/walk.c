@@ -0,0 +1,367 @@
+#include "ls.h"
+
+/*
+ * The path of the directory being listed, kept only for the header lines.
+ * Every open and stat goes through a directory fd, so it is never resolved
+ * by the kernel and has no length limit.
+ */
+static struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} cur_path;
+
+// Append "/name" (or just name when empty) and return the old length.
+size_t path_push(const char *name) {
+    size_t old = cur_path.len, nlen = strlen(name);
+    size_t need = old + nlen + 2;
+
+    if (need > cur_path.cap) {
+        size_t cap = cur_path.cap ? cur_path.cap : 256;
+        while (cap < need)
+            cap *= 2;
+        char *buf = realloc(cur_path.buf, cap);
+        stats_count(STATS_MALLOCS);
+        if (!buf) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        cur_path.buf = buf;
+        cur_path.cap = cap;
+    }
+
+    if (old > 0)
+        cur_path.buf[cur_path.len++] = '/';
+    memcpy(cur_path.buf + cur_path.len, name, nlen + 1);
+    cur_path.len += nlen;
+    return old;
+}
+
+static void path_pop(size_t old) {
+    cur_path.len = old;
+    cur_path.buf[old] = '\0';
+}
+
+/*
+ * Serial traversal
+ *
+ * The tree is walked with an explicit stack of frames rather than by
+ * recursion. A directory is listed in full and its arena memory released
+ * before anything below it is visited; only the names of its
+ * subdirectories are kept, in name_arena, until they have been listed.
+ * Peak memory is the largest single directory plus the pending names
+ * along the current path.
+ *
+ * Each frame holds its directory open so children are opened with
+ * openat(). At most max_dir_fds are open at once: past that the oldest
+ * open ancestor is closed, and reopened on the way back up through ".."
+ * from its child, checked against its device and inode.
+ */
+struct walk_frame {
+    int fd;                 // -1 while closed to stay under max_dir_fds
+    dev_t dev;              // recorded when the fd is closed
+    ino_t ino;
+    char *subdirs;          // subdirectories to visit, packed NUL-terminated names
+    size_t subdirs_len;
+    size_t next;            // offset of the next name in subdirs
+    size_t path_len;        // length of cur_path for this directory
+    struct arena_mark names_mark;
+};
+
+struct arena name_arena;            // subdirs of the frames on the stack
+int max_dir_fds = MAX_DIR_FDS;
+struct walk_stats walk_stats;
+
+// Append name to the open block of subdirectory names in name_arena.
+static char *subdir_append(char *block, size_t *len, const char *name) {
+    size_t n = strlen(name) + 1;
+    char *grown = arena_extend(&name_arena, block, *len, n);
+    if (!grown) {
+        perror("malloc failed");
+        return block;
+    }
+    memcpy(grown + *len, name, n);
+    *len += n;
+    return grown;
+}
+
+// Read, stat (for -l) and sort the open directory fd into l, allocating
+// from the arena; dotfiles only with show_all. Returns 0, or -1 after
+// reporting the error.
+int read_sorted(int fd, int display, int show_all, struct entry_list *l) {
+    struct dir_buffer db;
+
+    if (read_directory(&arena, fd, &db) == -1) {
+        perror("opendir failed");
+        return -1;
+    }
+    if (stat_needed(display) || use_color)
+        stat_dir_begin(fd);
+
+    if (collect_entries(&arena, &db, show_all, l) == -1) {
+        perror("malloc failed");
+        return -1;
+    }
+    l->dirfd = fd;
+
+    // Stat in directory order, before sorting moves the records around
+    if (stat_needed(display)) {
+        l->slots = arena_alloc(&arena, (l->count ? l->count : 1) * sizeof(struct stat_slot));
+        if (!l->slots) {
+            perror("malloc failed");
+            return -1;
+        }
+        prefetch_stats(l);
+    }
+
+    if (sort_entries(&arena, l) == -1) {
+        perror("malloc failed");
+        return -1;
+    }
+    return 0;
+}
+
+// List the open directory fd. With -R the names of its subdirectories are
+// left in name_arena for the walk, in listing order.
+static void list_one(int fd, int display, int recursive, int show_all,
+                     char **subdirs, size_t *subdirs_len) {
+    // Everything this directory allocates is released in one step at the end
+    struct arena_mark mark = arena_get_mark(&arena);
+    struct entry_list l;
+    struct stat dir_st;
+    unsigned int mask = display >= DISPLAY_LONG ? long_mask : 0;
+    int cacheable = snap_enabled() && stat_directory(fd, &dir_st) == 0;
+
+    if (cacheable && snap_lookup(&dir_st, mask, &l) == 0) {
+        l.dirfd = fd;
+        if (use_color)
+            stat_dir_begin(fd);
+    } else if (read_sorted(fd, display, show_all, &l) == -1) {
+        arena_release(&arena, mark);
+        return;
+    } else if (cacheable) {
+        snap_store(&dir_st, mask, &l);
+    }
+
+    print_listing(cur_path.buf, &l, display);
+
+    // Keep subdirectories for later, trusting d_type when the filesystem provides it
+    if (recursive) {
+        for (size_t i = 0; i < l.count; i++) {
+            const char *name = entry_name(&l, &l.ents[i]);
+            if (resolve_type(&l, &l.ents[i]) == DT_DIR &&
+                strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+                *subdirs = subdir_append(*subdirs, subdirs_len, name);
+        }
+        if (*subdirs)
+            arena_close_block(&name_arena, *subdirs_len);
+    }
+
+    arena_release(&arena, mark);
+}
+
+/*
+ * Unsorted streaming (-U, -f)
+ *
+ * Entries are printed in the order the directory returns them, one per
+ * line (or one long line with -l), straight out of a fixed-size read
+ * buffer. Nothing is sorted and no entry array is built, so memory stays
+ * constant however large the directory is. With -R only the names of
+ * subdirectories are kept, to be visited after the directory is done.
+ * --top streams the same way, into its heap instead of the output.
+ */
+
+// Stream the open directory fd. With -R the names of its subdirectories
+// are left in name_arena for the walk.
+static void stream_one(int fd, int display, int recursive, int show_all,
+                char **subdirs, size_t *subdirs_len) {
+    // Subdirectories are visited after the stream is closed, so every level
+    // shares one read buffer
+    static char *buf = NULL;
+    struct dir_stream ds;
+
+    if (!buf) {
+        buf = malloc(STREAM_BUF_SIZE);
+        stats_count(STATS_MALLOCS);
+        if (!buf) {
+            perror("malloc failed");
+            return;
+        }
+    }
+    if (top_count && top_enter(cur_path.buf) == -1) {
+        perror("malloc failed");
+        return;
+    }
+    if (dir_stream_open(&ds, fd, buf) == -1) {
+        perror("opendir failed");
+        if (top_count)
+            top_leave();
+        return;
+    }
+    if (stat_needed(display) || use_color)
+        stat_dir_begin(fd);
+
+    int phase = stats_begin(top_count ? PHASE_SORT : PHASE_RENDER);
+    size_t listed = 0;
+    if (!top_count && display < DISPLAY_NDJSON) {
+        out_char('\n');
+        out_str(cur_path.buf);
+        out_write(":\n", 2);
+    }
+
+    struct dir_record *rec;
+    while ((rec = dir_stream_next(&ds)) != NULL) {
+        if (!show_all && rec->d_name[0] == '.') continue;
+        listed++;
+
+        // A one-entry list straight over the record
+        struct stat_slot slot;
+        struct file_entry fe = { rec->d_ino, 0, NO_STAT, 0, strlen(rec->d_name), 0, rec->d_type, 0 };
+        struct entry_list one = { &fe, 1, rec->d_name, &slot, 0, fd, 0 };
+
+        if (top_count) {
+            top_offer(&one, display);
+        } else if (display >= DISPLAY_LONG) {
+            fe.stat_idx = 0;
+            stat_entry(&one, &fe, &slot);
+            if (display == DISPLAY_LONG)
+                list_long(&one);
+            else
+                list_records(cur_path.buf, &one, display);
+        } else {
+            print_colored(&one, &fe);
+            out_char('\n');
+        }
+
+        if (recursive && resolve_type(&one, &fe) == DT_DIR &&
+            strcmp(rec->d_name, ".") != 0 && strcmp(rec->d_name, "..") != 0)
+            *subdirs = subdir_append(*subdirs, subdirs_len, rec->d_name);
+    }
+    if (ds.err) {
+        errno = ds.err;
+        perror("readdir failed");
+    }
+    dir_stream_close(&ds);
+    if (top_count)
+        top_leave();
+    stats_count(STATS_DIRS);
+    stats_add(STATS_ENTRIES, listed);
+
+    if (*subdirs)
+        arena_close_block(&name_arena, *subdirs_len);
+    if (out_interactive)
+        out_flush();
+    stats_end(phase);
+}
+
+// Reopen the closed directory of frame f through ".." of its open child,
+// falling back to its path if that is not the same directory any more.
+static int walk_reopen(struct walk_frame *f, int child_fd) {
+    struct stat st;
+    walk_stats.reopens++;
+
+    int fd = open_directory(child_fd, "..");
+    if (fd != -1 && stat_directory(fd, &st) == 0 && st.st_dev == f->dev && st.st_ino == f->ino)
+        return fd;
+    if (fd != -1)
+        close_directory(fd);
+
+    char saved = cur_path.buf[f->path_len];
+    cur_path.buf[f->path_len] = '\0';
+    fd = open_directory(AT_FDCWD, cur_path.buf);
+    cur_path.buf[f->path_len] = saved;
+    return fd;
+}
+
+// List path (already in cur_path) and, with -R, everything below it.
+void walk_tree(const char *path, int display, int recursive, int show_all, int unsorted) {
+    struct walk_frame *stack = NULL;
+    size_t depth = 0, cap = 0;
+    size_t oldest_open = 0;     // frames below this index have their fd closed
+    int fd = open_directory(AT_FDCWD, path);
+
+    if (fd == -1) {
+        perror("opendir failed");
+        return;
+    }
+
+    for (;;) {
+        // fd is the newly opened directory named by cur_path
+        struct walk_frame f = { fd, 0, 0, NULL, 0, 0, cur_path.len,
+                                arena_get_mark(&name_arena) };
+        if (unsorted)
+            stream_one(fd, display, recursive, show_all, &f.subdirs, &f.subdirs_len);
+        else
+            list_one(fd, display, recursive, show_all, &f.subdirs, &f.subdirs_len);
+
+        // A directory with no subdirectories needs no frame
+        if (f.subdirs) {
+            if (depth == cap) {
+                cap = cap ? 2 * cap : 64;
+                struct walk_frame *grown = realloc(stack, cap * sizeof(struct walk_frame));
+                stats_count(STATS_MALLOCS);
+                if (!grown) {
+                    perror("malloc failed");
+                    exit(EXIT_FAILURE);
+                }
+                stack = grown;
+            }
+            stack[depth++] = f;
+            if (depth > walk_stats.max_depth)
+                walk_stats.max_depth = depth;
+        } else {
+            close_directory(fd);
+            arena_release(&name_arena, f.names_mark);
+        }
+
+        // Find the next subdirectory to open, popping finished frames
+        fd = -1;
+        while (depth > 0 && fd == -1) {
+            struct walk_frame *top = &stack[depth - 1];
+            path_pop(top->path_len);
+
+            if (top->next < top->subdirs_len) {
+                const char *name = top->subdirs + top->next;
+                top->next += strlen(name) + 1;
+
+                // Make room by closing the oldest open ancestor (never the parent)
+                if (depth - oldest_open >= (size_t)max_dir_fds) {
+                    struct walk_frame *old = &stack[oldest_open++];
+                    struct stat st;
+                    if (stat_directory(old->fd, &st) == 0) {
+                        old->dev = st.st_dev;
+                        old->ino = st.st_ino;
+                    }
+                    close_directory(old->fd);
+                    old->fd = -1;
+                }
+
+                path_push(name);
+                fd = open_directory(top->fd, name);
+                if (fd == -1)
+                    perror("opendir failed");
+                continue;
+            }
+
+            // Done with this directory: make sure its parent is open again
+            if (depth > 1 && stack[depth - 2].fd == -1) {
+                struct walk_frame *parent = &stack[depth - 2];
+                parent->fd = walk_reopen(parent, top->fd);
+                oldest_open = depth - 2;
+                if (parent->fd == -1) {
+                    // Its remaining subdirectories cannot be reached
+                    perror("opendir failed");
+                    parent->next = parent->subdirs_len;
+                }
+            }
+            if (top->fd != -1)
+                close_directory(top->fd);
+            arena_release(&name_arena, top->names_mark);
+            depth--;
+        }
+        if (fd == -1)
+            break;
+    }
+
+    free(stack);
+}
@@ -0,0 +1,303 @@
+#include "ls.h"
+
+/*
+ * Watch mode (--watch)
+ *
+ * The directory is listed once as usual and then kept up to date from
+ * inotify events instead of being read again. The sorted entry array is
+ * owned here and edited in place: a name that appears is stat'ed (for -l)
+ * and inserted at its binary-searched position, a name that goes away is
+ * removed, and with -l an entry whose inode changed is stat'ed again. Only
+ * those entries are printed, marked "+", "-" or "~". Names go to an
+ * append-only buffer and stat slots to an append-only array, both
+ * compacted once most of them belong to removed entries. If the kernel's
+ * event queue overflows, the directory is read and printed from scratch.
+ */
+#ifdef __linux__
+struct watch_list {
+    struct entry_list l;        // points at the buffers below
+    size_t cap;                 // of l.ents
+    char *names;
+    size_t names_len, names_cap, names_dead;
+    size_t nslots, slots_cap;   // l.slots, used by entries or dead
+};
+
+// Same order as sort_entries() by name: strxfrm() keys compare like
+// strcoll(), and -r turns it around
+static int compare_names(const char *a, const char *b) {
+    int c = sort_collate ? strcoll(a, b) : strcmp(a, b);
+    return sort_reverse ? -c : c;
+}
+
+// Position of name in the sorted array, or where it would be inserted.
+// Returns 1 if it is there.
+static int watch_find(const struct watch_list *w, const char *name, size_t *pos) {
+    size_t lo = 0, hi = w->l.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare_names(entry_name(&w->l, &w->l.ents[mid]), name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    // Names the locale collates as equal are in no particular order
+    *pos = lo;
+    for (size_t i = lo; i < w->l.count; i++) {
+        const char *other = entry_name(&w->l, &w->l.ents[i]);
+        if (compare_names(other, name) != 0)
+            break;
+        if (strcmp(other, name) == 0) {
+            *pos = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Rebuild the name buffer and the slots with only the live entries
+static int watch_compact(struct watch_list *w) {
+    size_t names_len = 0;
+    for (size_t i = 0; i < w->l.count; i++)
+        names_len += w->l.ents[i].name_len + 1;
+    char *names = malloc(names_len ? names_len : 1);
+    struct stat_slot *slots = w->l.slots ? malloc((w->l.count ? w->l.count : 1) *
+                                                  sizeof(struct stat_slot)) : NULL;
+    stats_add(STATS_MALLOCS, 1 + !!w->l.slots);
+    if (!names || (w->l.slots && !slots)) {
+        free(names);
+        free(slots);
+        return -1;
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0; i < w->l.count; i++) {
+        struct file_entry *fe = &w->l.ents[i];
+        memcpy(names + pos, entry_name(&w->l, fe), fe->name_len + 1);
+        fe->name_off = pos;
+        pos += fe->name_len + 1;
+        if (slots) {
+            slots[i] = w->l.slots[fe->stat_idx];
+            fe->stat_idx = i;
+        }
+    }
+
+    free(w->names);
+    free(w->l.slots);
+    w->names = names;
+    w->names_len = w->names_cap = names_len;
+    w->names_dead = 0;
+    w->l.names = names;
+    w->l.slots = slots;
+    w->nslots = w->slots_cap = slots ? w->l.count : 0;
+    return 0;
+}
+
+// Read the directory fd into w, replacing what it held
+static int watch_load(struct watch_list *w, int fd, int display) {
+    struct arena_mark mark = arena_get_mark(&arena);
+    struct entry_list l;
+    if (read_sorted(fd, display, 0, &l) == -1) {
+        arena_release(&arena, mark);
+        return -1;
+    }
+
+    // Copy out of the arena; the compaction packs the names
+    size_t n = l.count ? l.count : 1;
+    struct file_entry *ents = malloc(n * sizeof(struct file_entry));
+    struct stat_slot *slots = l.slots ? malloc(n * sizeof(struct stat_slot)) : NULL;
+    stats_add(STATS_MALLOCS, 1 + !!l.slots);
+    if (!ents || (l.slots && !slots)) {
+        free(ents);
+        arena_release(&arena, mark);
+        return -1;
+    }
+    memcpy(ents, l.ents, l.count * sizeof(struct file_entry));
+    if (slots)
+        memcpy(slots, l.slots, l.count * sizeof(struct stat_slot));
+    free(w->l.ents);
+    free(w->names);
+    free(w->l.slots);
+    w->l = l;
+    w->l.ents = ents;
+    w->l.slots = slots;
+    w->cap = n;
+    w->names = NULL;
+    int rc = watch_compact(w);
+    arena_release(&arena, mark);
+    if (rc == -1)
+        perror("malloc failed");
+    return rc;
+}
+
+// Insert name at pos, with a stat for -l. Returns 0 or -1.
+static int watch_insert(struct watch_list *w, size_t pos, const char *name, int is_dir, int display) {
+    size_t len = strlen(name);
+    if (w->l.count == w->cap) {
+        size_t cap = w->cap * 2;
+        struct file_entry *ents = realloc(w->l.ents, cap * sizeof(struct file_entry));
+        stats_count(STATS_MALLOCS);
+        if (!ents)
+            return -1;
+        w->l.ents = ents;
+        w->cap = cap;
+    }
+    if (w->names_len + len + 1 > w->names_cap) {
+        size_t cap = w->names_cap ? w->names_cap : 4096;
+        while (cap < w->names_len + len + 1)
+            cap *= 2;
+        char *names = realloc(w->names, cap);
+        stats_count(STATS_MALLOCS);
+        if (!names)
+            return -1;
+        w->names = names;
+        w->names_cap = cap;
+        w->l.names = names;
+    }
+    if (display >= DISPLAY_LONG && w->nslots == w->slots_cap) {
+        size_t cap = w->slots_cap ? w->slots_cap * 2 : 64;
+        struct stat_slot *slots = realloc(w->l.slots, cap * sizeof(struct stat_slot));
+        stats_count(STATS_MALLOCS);
+        if (!slots)
+            return -1;
+        w->l.slots = slots;
+        w->slots_cap = cap;
+    }
+
+    struct file_entry fe = { 0, w->names_len, NO_STAT, 0, len, display_width(name, len),
+                             is_dir ? DT_DIR : DT_UNKNOWN, 0 };
+    memcpy(w->names + w->names_len, name, len + 1);
+    w->names_len += len + 1;
+    memmove(&w->l.ents[pos + 1], &w->l.ents[pos], (w->l.count - pos) * sizeof(struct file_entry));
+    w->l.ents[pos] = fe;
+    w->l.count++;
+    if (fe.width > w->l.max_width)
+        w->l.max_width = fe.width;
+
+    if (display >= DISPLAY_LONG) {
+        w->l.ents[pos].stat_idx = w->nslots++;
+        stat_entry(&w->l, &w->l.ents[pos], &w->l.slots[w->l.ents[pos].stat_idx]);
+    }
+    return 0;
+}
+
+static void watch_remove(struct watch_list *w, size_t pos) {
+    w->names_dead += w->l.ents[pos].name_len + 1;
+    memmove(&w->l.ents[pos], &w->l.ents[pos + 1], (w->l.count - pos - 1) * sizeof(struct file_entry));
+    w->l.count--;
+
+    // Dead slots are as many as dead names are, roughly, so one check does
+    if (w->names_dead > w->names_len / 2 && w->names_len > 4096 && watch_compact(w) == -1)
+        perror("malloc failed");
+}
+
+// Re-stat the entry at pos. Returns 1 if anything -l shows has changed.
+static int watch_restat(struct watch_list *w, size_t pos) {
+    struct file_entry *fe = &w->l.ents[pos];
+    struct stat_slot *slot = &w->l.slots[fe->stat_idx];
+    struct stat_slot old = *slot;
+    stat_entry(&w->l, fe, slot);
+    return slot->err != old.err || slot->st.st_mode != old.st.st_mode ||
+           slot->st.st_nlink != old.st.st_nlink || slot->st.st_uid != old.st.st_uid ||
+           slot->st.st_gid != old.st.st_gid || slot->st.st_size != old.st.st_size ||
+           slot->st.st_mtime != old.st.st_mtime || slot->btime.tv_sec != old.btime.tv_sec;
+}
+
+// One changed entry, marked, as the listing shows it
+static void watch_print(const struct watch_list *w, size_t pos, char mark, int display) {
+    struct entry_list one = w->l;
+    one.ents = &w->l.ents[pos];
+    one.count = 1;
+    out_char(mark);
+    out_char(' ');
+    if (display == DISPLAY_LONG) {
+        list_long(&one);
+    } else {
+        print_colored(&one, one.ents);
+        out_char('\n');
+    }
+}
+
+void watch_directory(const char *path, int display) {
+    struct watch_list w = { 0 };
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                    IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+    if (display == DISPLAY_LONG)
+        mask |= IN_ATTRIB | IN_CLOSE_WRITE;
+
+    // Watch before reading, so nothing between the two is missed
+    int ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd == -1 || inotify_add_watch(ifd, path, mask) == -1) {
+        perror("inotify failed");
+        return;
+    }
+    int fd = open_directory(AT_FDCWD, path);
+    if (fd == -1) {
+        perror("opendir failed");
+        return;
+    }
+    if (watch_load(&w, fd, display) == -1)
+        return;
+    w.l.dirfd = fd;
+    print_listing(path, &w.l, display);
+    out_flush();
+
+    char buf[64 << 10] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(ifd, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            perror("inotify read failed");
+            break;
+        }
+
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // Events were lost; start over
+                if (watch_load(&w, fd, display) == -1)
+                    return;
+                w.l.dirfd = fd;
+                print_listing(path, &w.l, display);
+                continue;
+            }
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_UNMOUNT)) {
+                out_flush();
+                return;
+            }
+            if (!ev->len || ev->name[0] == '.')
+                continue;
+
+            // Events may repeat what the first read already saw, so each
+            // one only prints a real change
+            size_t pos;
+            int found = watch_find(&w, ev->name, &pos);
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                if (found) {
+                    watch_print(&w, pos, '-', display);
+                    watch_remove(&w, pos);
+                }
+            } else if (!found) {
+                if (!(ev->mask & (IN_CREATE | IN_MOVED_TO)))
+                    continue;
+                if (watch_insert(&w, pos, ev->name, ev->mask & IN_ISDIR, display) == -1)
+                    perror("malloc failed");
+                else
+                    watch_print(&w, pos, '+', display);
+            } else if (display == DISPLAY_LONG && watch_restat(&w, pos)) {
+                watch_print(&w, pos, '~', display);
+            }
+        }
+        out_flush();
+    }
+}
+#else
+void watch_directory(const char *path, int display) {
+    (void)path;
+    (void)display;
+    fprintf(stderr, "--watch needs inotify\n");
+}
+#endif
@@ -0,0 +1,41 @@
+#!/bin/sh
+# -f lists dotfiles, "." and "..", also when a later option sorts again.
+#
+# Usage: tests/dotfiles.sh [LS]
+
+set -e
+
+LS=${1:-bin/ls}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+mkdir "$tmp/sub"
+touch "$tmp/.hid" "$tmp/a" "$tmp/b" "$tmp/sub/.x"
+
+# check ARGS...: the listing of $tmp must include every name
+failed=0
+check() {
+    out=$("$LS" "$@" "$tmp" 2>&1 | tr -s ' ' '\n') || true
+    missing=
+    for name in . .. .hid a b sub; do
+        printf '%s\n' "$out" | grep -Fqx -- "$name" || missing="$missing $name"
+    done
+    if [ -z "$missing" ]; then
+        echo "ok: ls $*"
+    else
+        echo "FAIL: ls $* is missing$missing"
+        failed=1
+    fi
+}
+
+check -f
+check -f -t
+check -f -S
+check -f -X
+check -f -v
+check -f --sort=name
+check -f -s
+check -f -t -R
+check -f -t -R --threads=4
+check -f -t --top=10
+exit $failed
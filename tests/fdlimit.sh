@@ -0,0 +1,74 @@
+#!/bin/sh
+# Parallel -R under a low descriptor limit: the output must match the
+# serial walk on a tree deeper than the limit.
+#
+# Usage: tests/fdlimit.sh [LS]
+#
+#   TEST_DIR     where the tree is built (default a temporary directory)
+#   TEST_DEPTH   levels of the tree (default 1500)
+#   TEST_RUNS    runs of each case (default 10)
+#
+# Every level has the chain's next directory, a, first in order and three
+# empty siblings, so the workers go deep while the siblings keep their
+# parents open.
+
+set -e
+
+LS=${1:-bin/ls}
+TEST_DEPTH=${TEST_DEPTH:-1500}
+TEST_RUNS=${TEST_RUNS:-10}
+if [ -n "$TEST_DIR" ]; then
+    mkdir -p "$TEST_DIR"
+    tmp=$TEST_DIR
+else
+    tmp=$(mktemp -d)
+    trap 'rm -rf "$tmp"' EXIT
+fi
+
+if [ ! -e "$tmp/tree/.complete" ]; then
+    rm -rf "$tmp/tree"
+    mkdir "$tmp/tree"
+    (
+        cd "$tmp/tree"
+        i=0
+        while [ "$i" -lt "$TEST_DEPTH" ]; do
+            mkdir a b c d
+            cd a
+            i=$((i + 1))
+        done
+    )
+    : > "$tmp/tree/.complete"
+fi
+
+# check NAME ARGS...: the parallel walk with ARGS, under ulimit -n
+# $LIMIT (default 64), against the serial one
+failed=0
+check() {
+    name=$1
+    shift
+    limit=${LIMIT:-64}
+    "$LS" --threads=1 "$@" "$tmp/tree" > "$tmp/expected"
+    i=0 bad=0
+    while [ "$i" -lt "$TEST_RUNS" ]; do
+        if ! (ulimit -n "$limit" && "$LS" --threads=4 "$@" "$tmp/tree" > "$tmp/actual" 2> "$tmp/errors") ||
+           [ -s "$tmp/errors" ] || ! cmp -s "$tmp/expected" "$tmp/actual"; then
+            bad=$((bad + 1))
+        fi
+        i=$((i + 1))
+    done
+    if [ "$bad" -eq 0 ]; then
+        echo "ok: $name"
+    else
+        echo "FAIL: $name ($bad of $TEST_RUNS runs)"
+        head -n 3 "$tmp/errors"
+        failed=1
+    fi
+}
+
+check "ls -R" -R
+check "ls -R -l" -R -l
+check "ls -R -s" -R -s
+check "ls -s" -s
+# --max-fds replaces the limit-based cap, so it must keep within 16 alone
+LIMIT=16 check "ls -R -s --max-fds=8" -R -s --max-fds=8
+exit $failed